@@ -0,0 +1,161 @@
+#include <string.h>
+#include <iostream>
+#include <map>
+#include <string>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "batch.h"
+#include "eventlog.h"
+#include "extsort.h"
+#include "conflate.h"
+#include "stats.h"
+#include "unified.h"
+#include "trace.h"
+
+static char batch_table[N_PAIR];
+static unsigned long long batch_timestamp = 0;
+static unsigned int batch_n = 0;
+
+static double batch_price[N_BATCH];
+static double batch_size[N_BATCH];
+static unsigned char batch_side[N_BATCH];
+
+// inserts of N_BATCH_ROWS rows by table, prepared for this connection,
+// staging may switch to another one. the rest of a batch uses level_statement
+static sqlite3 *stmt_db = NULL;
+static std::map<std::string, sqlite3_stmt *> statements;
+
+static void apply_side(double *size, const unsigned char *side, unsigned int n) {
+    for (unsigned int i = 0; i < n; i++) {
+        if (side[i]) {
+            size[i] = -size[i];
+        }
+    }
+}
+
+static sqlite3_stmt *prepare_insert(sqlite3 *db, unsigned int rows) {
+    std::string sql = "INSERT INTO '";
+    sql += batch_table;
+    sql += "' VALUES(?, ?, ?)";
+
+    for (unsigned int i = 1; i < rows; i++) {
+        sql += ", (?, ?, ?)";
+    }
+
+    sqlite3_stmt *stmt;
+
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, NULL) != SQLITE_OK) {
+        std::cerr << "batch: sqlite error: " << sqlite3_errmsg(db) << std::endl;
+        exit(1);
+    }
+
+    return stmt;
+}
+
+static sqlite3_stmt *statement_of(sqlite3 *db) {
+    if (db != stmt_db) {
+        for (auto i = statements.begin(); i != statements.end(); i++) {
+            sqlite3_finalize(i->second);
+        }
+        statements.clear();
+
+        stmt_db = db;
+    }
+
+    sqlite3_stmt *&stmt = statements[batch_table];
+
+    if (stmt == NULL) {
+        stmt = prepare_insert(db, N_BATCH_ROWS);
+    }
+
+    return stmt;
+}
+
+// insert rows from first, as many as stmt has rows for
+static void insert_rows(sqlite3 *db, sqlite3_stmt *stmt, unsigned int first, unsigned int rows) {
+    for (unsigned int i = 0; i < rows; i++) {
+        sqlite3_bind_int64(stmt, i*3 + 1, batch_timestamp);
+        sqlite3_bind_double(stmt, i*3 + 2, batch_price[first + i]);
+        sqlite3_bind_double(stmt, i*3 + 3, batch_size[first + i]);
+    }
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        std::cerr << "batch: sqlite error: " << sqlite3_errmsg(db) << std::endl;
+        exit(1);
+    }
+
+    sqlite3_reset(stmt);
+
+    // rows of a single insert get consecutive rowids
+    sqlite3_int64 last = sqlite3_last_insert_rowid(db);
+
+    for (unsigned int i = 0; i < rows; i++) {
+        stats_row(batch_table, last - rows + 1 + i, batch_timestamp, batch_price[first + i]);
+    }
+}
+
+static void write_batch(sqlite3 *db) {
+    apply_side(batch_size, batch_side, batch_n);
+
+    if (conflate_enabled() || extsort_enabled() || unified_enabled()) {
+        // these stages work on single rows
+        for (unsigned int i = 0; i < batch_n; i++) {
+            insert_book(db, batch_table, batch_timestamp, batch_price[i], batch_size[i]);
+        }
+        return;
+    }
+
+    for (unsigned int i = 0; i < batch_n; i++) {
+        eventlog_book(batch_table, batch_timestamp, batch_price[i], batch_size[i]);
+    }
+
+    TraceSpan span(TraceInsert);
+
+    unsigned int i = 0;
+
+    if (batch_n >= N_BATCH_ROWS) {
+        sqlite3_stmt *stmt = statement_of(db);
+
+        for (; i + N_BATCH_ROWS <= batch_n; i += N_BATCH_ROWS) {
+            insert_rows(db, stmt, i, N_BATCH_ROWS);
+        }
+    }
+
+    for (; i < batch_n; i++) {
+        insert_rows(db, level_statement(db, batch_table), i, 1);
+    }
+}
+
+void book_batch_begin(sqlite3 *db, const char *table_name, unsigned long long timestamp) {
+    if (batch_n > 0 && batch_timestamp == timestamp && strcmp(batch_table, table_name) == 0) {
+        return;
+    }
+
+    book_batch_end(db);
+
+    strcpy(batch_table, table_name);
+    batch_timestamp = timestamp;
+}
+
+void book_batch_add(sqlite3 *db, double price, double size, int side) {
+    if (batch_n == N_BATCH) {
+        // full, keep collecting into the same table after writing
+        write_batch(db);
+        batch_n = 0;
+    }
+
+    batch_price[batch_n] = price;
+    batch_size[batch_n] = size;
+    batch_side[batch_n] = side != 0;
+    batch_n++;
+}
+
+void book_batch_end(sqlite3 *db) {
+    if (batch_n == 0) {
+        return;
+    }
+
+    write_batch(db);
+    batch_n = 0;
+}
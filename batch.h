@@ -0,0 +1,27 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <sqlite3.h>
+
+// collects the levels of an orderbook snapshot into column arrays and writes them
+// with cached multi-row inserts instead of one statement per level.
+// values are bound as doubles like write_book binds them.
+// levels are written in the order they were added, at the end of the batch or
+// when the table or timestamp changes
+
+// levels held before writing
+#define N_BATCH 8192
+// rows per insert statement, 3 parameters each
+#define N_BATCH_ROWS 64
+
+// start collecting levels of table_name, writes levels collected so far if they
+// belong to another table or timestamp
+void book_batch_begin(sqlite3 *db, const char *table_name, unsigned long long timestamp);
+
+// side is 1 if the size has to be negated (ask or sell), 0 if not
+void book_batch_add(sqlite3 *db, double price, double size, int side);
+
+// write levels collected so far
+void book_batch_end(sqlite3 *db);
+
+#endif
@@ -4,10 +4,16 @@
 #include <rapidjson/document.h>
 
 #include "common.h"
+#include "latency.h"
+#include "dedup.h"
+#include "trace.h"
+#include "batch.h"
 
 using namespace rapidjson;
 
-std::map<int, char *> chanIds;
+// channel ids are assigned per connection, so merged captures each have their own
+std::map<int, char *> chanIds[N_SOURCE];
+unsigned int source = 0;
 
 inline void bitfinex_book_single(sqlite3 *db,
     unsigned long long line_timestamp,
@@ -20,14 +26,7 @@ inline void bitfinex_book_single(sqlite3 *db,
     double amount = array[2].GetDouble();
 
     // insert into table corresponding to the channel name
-    char *sql = (char *) malloc(sizeof(char)*N_SQL);
-
-    // construct a sql statement
-    snprintf(sql, N_SQL, "INSERT INTO '%s' VALUES(%llu, %.10f, %.10f)", channel, line_timestamp, price, amount);
-
-    execute_insert(db, sql);
-
-    free(sql);
+    insert_book(db, channel, line_timestamp, price, amount);
 }
 
 inline void bitfinex_book(sqlite3 *db,
@@ -37,9 +36,15 @@ inline void bitfinex_book(sqlite3 *db,
 
     if (array[0].IsArray()) {
         // it is the first message, and its getting the full orderbook
+        // amounts are already negative for asks
+        book_batch_begin(db, channel, line_timestamp);
+
         for (auto i = array.begin(); i != array.end(); i++) {
-            bitfinex_book_single(db, line_timestamp, channel, i->GetArray());
+            auto level = i->GetArray();
+            book_batch_add(db, level[0].GetDouble(), level[2].GetDouble(), 0);
         }
+
+        book_batch_end(db);
     } else {
         // single orderbook update
         bitfinex_book_single(db, line_timestamp, channel, array);
@@ -47,27 +52,49 @@ inline void bitfinex_book(sqlite3 *db,
 }
 
 inline void bitfinex_trades(sqlite3 *db,
+    unsigned long long line_timestamp,
     char *channel,
     rapidjson::GenericArray<false, rapidjson::Value::ValueType> array) {
  
-    // unsigned int tradeId = doc[0].GetUint();
+    unsigned long long trade_id = array[0].GetUint64();
+
+    // the same trade from another capture
+    if (dedup_enabled() && dedup_trade(dedup_hash(&trade_id, sizeof(trade_id)), line_timestamp)) {
+        return;
+    }
+
     // millisec timestamp
     unsigned long long timestamp = array[1].GetUint64();
     // convert it to nanosec timestamp
-    timestamp *= 1000;
+    timestamp *= 1000000;
+
+    latency_record(channel, line_timestamp, timestamp);
+
+    if (!nanosec_timestamps) {
+        // microsec as stored without -n
+        timestamp /= 1000;
+    }
+
     // negative if sell
     double amount = array[2].GetDouble();
     double price = array[3].GetDouble();
 
     // insert into table corresponding to the channel name
-    char *sql = (char *) malloc(sizeof(char)*N_SQL);
+    insert_trade(db, channel, timestamp, price, amount);
+}
 
-    // construct a sql statement
-    snprintf(sql, N_SQL, "INSERT INTO '%s' VALUES(%llu, %.10f, %.10f)", channel, timestamp, price, amount);
+void bitfinex_set_source(unsigned int capture) {
+    source = capture;
+}
+
+const char *bitfinex_channel_name(unsigned int capture, unsigned int chanId) {
+    auto found = chanIds[capture].find(chanId);
 
-    execute_insert(db, sql);
+    if (found == chanIds[capture].end()) {
+        return NULL;
+    }
 
-    free(sql);
+    return found->second;
 }
 
 void bitfinex_emit(sqlite3 *db,
@@ -93,7 +120,9 @@ void bitfinex_msg(sqlite3 *db,
             char *channel = (char *) malloc(sizeof(char)*N_PAIR);
             snprintf(channel, N_PAIR, "%s_%s", event_channel, symbol);
 
-            chanIds[chanId] = channel;
+            chanIds[source][chanId] = channel;
+
+            trace_instant("subscribed", channel);
 
             TableType tt;
             if (strcmp(event_channel, "trades")) {
@@ -121,7 +150,7 @@ void bitfinex_msg(sqlite3 *db,
 
         unsigned int chanId = doc[0].GetUint();
 
-        char *channel = chanIds[chanId];
+        char *channel = chanIds[source][chanId];
 
         if (strncmp(channel, "trades", strlen("trades")) == 0) {
             if (doc[1].IsArray()) {
@@ -137,7 +166,7 @@ void bitfinex_msg(sqlite3 *db,
                 auto array = doc[2].GetArray();
 
                 // trade execution
-                bitfinex_trades(db, channel, array);
+                bitfinex_trades(db, line_timestamp, channel, array);
             } else if (type[0] == 't' && type[1] == 'u') {
                 // trade update, ignore
                 return;
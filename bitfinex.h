@@ -4,6 +4,12 @@
 #include <sqlite3.h>
 #include <rapidjson/document.h>
 
+// captures merged together each have their own channel ids, select whose are used
+void bitfinex_set_source(unsigned int capture);
+
+// name of a channel id of a capture, NULL if it is not subscribed
+const char *bitfinex_channel_name(unsigned int capture, unsigned int chanId);
+
 void bitfinex_emit(sqlite3 *db, unsigned long long line_timestamp, rapidjson::Document &doc);
 
 void bitfinex_msg(sqlite3 *db, unsigned long long line_timestamp, rapidjson::Document &doc);
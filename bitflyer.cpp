@@ -6,6 +6,10 @@
 
 #include "bitflyer.h"
 #include "common.h"
+#include "latency.h"
+#include "dedup.h"
+#include "trace.h"
+#include "batch.h"
 
 using namespace rapidjson;
 
@@ -19,19 +23,37 @@ inline unsigned long long bitflyer_time(const char *str) {
     strptime(str, "%Y-%m-%dT%H:%M:%S", &time);
 
     nanosec = ((unsigned long long) timegm(&time)) * 1000000000;
-    nanosec += atol(str+strlen("2020-01-01T19:12:03.")) * 1000;
+
+    // number of fractional digits varies, up to 7 and trailing zeros are omitted
+    const char *fraction = str + strlen("2020-01-01T19:12:03");
+    unsigned long long scale = 100000000;
+
+    if (*fraction == '.') {
+        for (fraction++; *fraction >= '0' && *fraction <= '9' && scale > 0; fraction++) {
+            nanosec += (*fraction - '0') * scale;
+            scale /= 10;
+        }
+    }
 
     return nanosec;
 }
 
+// time stored into tables, nanosec is bitflyer_time(str)
+inline unsigned long long bitflyer_stored_time(const char *str, unsigned long long nanosec) {
+    if (nanosec_timestamps) {
+        return nanosec;
+    }
+
+    // without -n, the fraction is scaled by 1000 whatever its number of digits as it always was
+    return nanosec / 1000000000 * 1000000000 + atol(str+strlen("2020-01-01T19:12:03.")) * 1000;
+}
+
 inline void bitflyer_executions(sqlite3 *db,
     unsigned long long line_timestamp,
     const char *channel,
     rapidjson::GenericArray<false, rapidjson::Value::ValueType> &array) {
 
     // process messages
-    char *sql = (char *) malloc(sizeof(char)*N_SQL);
-
     const char *sideUpper;
     unsigned long long time;
     // negative if sell, positive if buy
@@ -62,17 +84,34 @@ inline void bitflyer_executions(sqlite3 *db,
             continue;
         }
         
-        time = bitflyer_time(obj["exec_date"].GetString());
+        const char *exec_date = obj["exec_date"].GetString();
+        time = bitflyer_time(exec_date);
+
         price = obj["price"].GetDouble();
         size = obj["size"].GetDouble();
 
-        // construct sql
-        snprintf(sql, N_SQL, "INSERT INTO '%s' VALUES(%llu, %.10f, %.10f)", channel, time, price, size);
+        // the same execution from another capture, executions have no id shared by every
+        // channel so compare what is in them
+        if (dedup_enabled()) {
+            const char *buy_id = obj["buy_child_order_acceptance_id"].GetString();
+            const char *sell_id = obj["sell_child_order_acceptance_id"].GetString();
+
+            uint64_t fingerprint = dedup_hash(exec_date, strlen(exec_date));
+            fingerprint = dedup_hash(sideUpper, strlen(sideUpper), fingerprint);
+            fingerprint = dedup_hash(&price, sizeof(double), fingerprint);
+            fingerprint = dedup_hash(&size, sizeof(double), fingerprint);
+            fingerprint = dedup_hash(buy_id, strlen(buy_id), fingerprint);
+            fingerprint = dedup_hash(sell_id, strlen(sell_id), fingerprint);
+
+            if (dedup_trade(fingerprint, line_timestamp)) {
+                continue;
+            }
+        }
 
-        execute_insert(db, sql);
-    }
+        latency_record(channel, line_timestamp, time);
 
-    free(sql);
+        insert_trade(db, channel, bitflyer_stored_time(exec_date, time), price, size);
+    }
 }
 
 // side is 0 if buy, 1 if sell
@@ -82,8 +121,6 @@ inline void bitflyer_board_side(sqlite3 *db,
     rapidjson::GenericArray<false, rapidjson::Value::ValueType> &array,
     const int side) {
 
-    char *sql = (char*) malloc(sizeof(char)*N_SQL);
-
     for (auto i = array.begin(); i != array.end(); i++) {
         auto obj = i->GetObject();
 
@@ -96,12 +133,8 @@ inline void bitflyer_board_side(sqlite3 *db,
             size = -size;
         }
 
-        snprintf(sql, N_SQL, "INSERT INTO '%s' VALUES(%llu, %.10f, %.10f)", table_name, line_timestamp, price, size);
-
-        execute_insert(db, sql);
+        insert_book(db, table_name, line_timestamp, price, size);
     }
-
-    free(sql);
 }
 
 inline void bitflyer_board_snapshot(sqlite3 *db,
@@ -120,8 +153,17 @@ inline void bitflyer_board_snapshot(sqlite3 *db,
     auto bids_array = obj["bids"].GetArray();
     auto asks_array = obj["asks"].GetArray();
 
-    bitflyer_board_side(db, line_timestamp, table_name, bids_array, 0);
-    bitflyer_board_side(db, line_timestamp, table_name, asks_array, 1);
+    // the whole board is written at once, sizes of asks are negated in the batch
+    book_batch_begin(db, table_name, line_timestamp);
+
+    for (auto i = bids_array.begin(); i != bids_array.end(); i++) {
+        book_batch_add(db, (*i)["price"].GetDouble(), (*i)["size"].GetDouble(), 0);
+    }
+    for (auto i = asks_array.begin(); i != asks_array.end(); i++) {
+        book_batch_add(db, (*i)["price"].GetDouble(), (*i)["size"].GetDouble(), 1);
+    }
+
+    book_batch_end(db);
 
     free(table_name);
 }
@@ -143,36 +185,23 @@ inline void bitflyer_ticker(sqlite3 *db,
     const char *channel,
     rapidjson::GenericObject<false, rapidjson::Value> &obj) {
 
-    unsigned long long timestamp = bitflyer_time(obj["timestamp"].GetString());
-    double best_bid = obj["best_bid"].GetDouble();
-    double best_bid_size = obj["best_bid_size"].GetDouble();
-    double total_bid_depth = obj["total_bid_depth"].GetDouble();
-    double best_ask = obj["best_ask"].GetDouble();
-    double best_ask_size = obj["best_ask_size"].GetDouble();
-    double total_ask_depth = obj["total_ask_depth"].GetDouble();
-    double last_traded_price = obj["ltp"].GetDouble();
-    double volume = obj["volume"].GetDouble();
-    double volume_by_product = obj["volume_by_product"].GetDouble();
-
-    char *sql = (char *) malloc(sizeof(char)*N_SQL);
-
-    snprintf(sql, N_SQL,
-        "INSERT INTO '%s' VALUES(%llu, %.10f, %.7f, %.12f, %.10f, %.7f, %.12f, %.10f, %.12f, %.12f)",
-        channel,
-        timestamp,
-        best_bid,
-        best_bid_size,
-        total_bid_depth,
-        best_ask,
-        best_ask_size,
-        total_ask_depth,
-        last_traded_price,
-        volume,
-        volume_by_product);
-
-    execute_insert(db, sql);
-
-    free(sql);
+    const char *time = obj["timestamp"].GetString();
+    unsigned long long timestamp = bitflyer_time(time);
+    TickerData ticker;
+
+    latency_record(channel, line_timestamp, timestamp);
+
+    ticker.best_bid = obj["best_bid"].GetDouble();
+    ticker.best_bid_size = obj["best_bid_size"].GetDouble();
+    ticker.total_bid_depth = obj["total_bid_depth"].GetDouble();
+    ticker.best_ask = obj["best_ask"].GetDouble();
+    ticker.best_ask_size = obj["best_ask_size"].GetDouble();
+    ticker.total_ask_depth = obj["total_ask_depth"].GetDouble();
+    ticker.last_traded_price = obj["ltp"].GetDouble();
+    ticker.volume = obj["volume"].GetDouble();
+    ticker.volume_by_product = obj["volume_by_product"].GetDouble();
+
+    insert_ticker(db, channel, bitflyer_stored_time(time, timestamp), ticker);
 }
 
 void bitflyer_emit(sqlite3 *db, unsigned long long line_timestamp, Document &doc) {
@@ -196,6 +225,8 @@ void bitflyer_emit(sqlite3 *db, unsigned long long line_timestamp, Document &doc
         exit(1);
     }
 
+    trace_instant("subscribe", channel);
+
     create_new_table(db, tt, channel);
 }
 
@@ -4,6 +4,9 @@
 
 #include "common.h"
 #include "bitmex.h"
+#include "dedup.h"
+#include "trace.h"
+#include "batch.h"
 
 void bitmex_trade(sqlite3 *db, unsigned long long line_timestamp, rapidjson::Document &doc) {
     const char *action = doc["action"].GetString();
@@ -27,9 +30,18 @@ void bitmex_trade(sqlite3 *db, unsigned long long line_timestamp, rapidjson::Doc
 
         free(table_name);
     } else if (strcmp(action, "insert") == 0) {
-        char *sql = (char *) malloc(sizeof(char)*N_SQL);
+        char *table_name = (char *) malloc(sizeof(char)*N_PAIR);
         
         for (auto i = data.begin(); i != data.end(); i++) {
+            // the same trade from another capture
+            if (dedup_enabled()) {
+                const char *match_id = (*i)["trdMatchID"].GetString();
+
+                if (dedup_trade(dedup_hash(match_id, strlen(match_id)), line_timestamp)) {
+                    continue;
+                }
+            }
+
             const char *symbol = (*i)["symbol"].GetString();
             const char *side = (*i)["side"].GetString();
             int64_t size = (*i)["size"].GetUint64();
@@ -40,12 +52,12 @@ void bitmex_trade(sqlite3 *db, unsigned long long line_timestamp, rapidjson::Doc
                 size = -size;
             }
 
-            snprintf(sql, N_SQL, "INSERT INTO 'trade_%s' VALUES (%llu, %.10f, %ld)", symbol, line_timestamp, price, size);
+            snprintf(table_name, N_PAIR, "trade_%s", symbol);
 
-            execute_insert(db, sql);
+            insert_trade(db, table_name, line_timestamp, price, size);
         }
 
-        free(sql);
+        free(table_name);
     } else {
         std::cerr << "unknown action: " << action << std::endl;
         exit(1);
@@ -72,7 +84,9 @@ void bitmex_orderbook(sqlite3 *db, unsigned long long line_timestamp, rapidjson:
 
     auto data = doc["data"].GetArray();
 
-    char *sql = (char *) malloc(sizeof(char)*N_SQL);
+    // partial is the whole orderbook, its levels are written in batches
+    const bool snapshot = strcmp(action, "partial") == 0;
+
     char *table_name = (char *) malloc(sizeof(char)*N_PAIR);
 
     for (auto i = data.begin(); i != data.end(); i++) {
@@ -104,7 +118,7 @@ void bitmex_orderbook(sqlite3 *db, unsigned long long line_timestamp, rapidjson:
 
         } else {
             std::cerr << "unknown action: " << action << std::endl;
-            free(sql);
+            free(table_name);
             exit(1);
         }
 
@@ -115,34 +129,42 @@ void bitmex_orderbook(sqlite3 *db, unsigned long long line_timestamp, rapidjson:
         }
 
         /* set size */
-        int64_t size;
+        // double so a deleted sell level becomes -0.0 and keeps its side for conflation
+        double size;
         if (strcmp(action, "partial") == 0 || strcmp(action, "insert") == 0 || strcmp(action, "update") == 0) {
             size = (*i)["size"].GetInt64();
-
-            // if sell is 1 (true) then -size, 0 then size
-            if (strcmp(side, "Sell") == 0) {
-                size = -size;
-            }
         } else if (strcmp(action, "delete") == 0) {
             // size is zero
 
             size = 0;
         }
 
+        // if sell is 1 (true) then -size, 0 then size
+        // the batch negates sizes of a snapshot itself
+        if (!snapshot && strcmp(side, "Sell") == 0) {
+            size = -size;
+        }
+
         /* insert into a database */
         snprintf(table_name, N_PAIR, "orderBookL2_%s", symbol);
         
-        if (strcmp(action, "partial") == 0) {
+        if (snapshot) {
             // create new table
             create_new_table(db, Book, table_name);
+
+            // a partial may hold several symbols, begin writes levels of the previous one
+            book_batch_begin(db, table_name, line_timestamp);
+            book_batch_add(db, price, size, strcmp(side, "Sell") == 0);
+            continue;
         }
 
         // insert
-        snprintf(sql, N_SQL, "INSERT INTO '%s' VALUES (%llu, %.10f, %ld)", table_name, line_timestamp, price, size);
-        execute_insert(db, sql);
+        insert_book(db, table_name, line_timestamp, price, size);
     }
 
-    free(sql);
+    book_batch_end(db);
+
+    free(table_name);
 }
 
 void bitmex_emit(sqlite3 *db, unsigned long long line_timestamp, rapidjson::Document &doc) {
@@ -159,6 +181,9 @@ void bitmex_msg(sqlite3 *db, unsigned long long line_timestamp, rapidjson::Docum
     }
     if (doc.HasMember("success")) {
         // a response to subscription
+        if (doc.HasMember("subscribe") && doc["subscribe"].IsString()) {
+            trace_instant("subscribed", doc["subscribe"].GetString());
+        }
         return;
     }
     if (doc.HasMember("error")) {
@@ -0,0 +1,107 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <iostream>
+#include <vector>
+
+// sends jobs to a convert server and prints its reports.
+// all jobs are sent before any report is read so they queue up on the server
+//   convert_client socket exchange file [file...]
+//   convert_client socket shutdown
+
+#define N_JOB 4096
+
+int connect_server(const char *socket_path) {
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)) != 0) {
+        std::cerr << "could not connect to " << socket_path << ": " << strerror(errno) << std::endl;
+        exit(1);
+    }
+
+    return fd;
+}
+
+void send_line(int fd, const char *line) {
+    size_t len = strlen(line);
+
+    while (len > 0) {
+        ssize_t n = write(fd, line, len);
+
+        if (n <= 0) {
+            std::cerr << "write failed: " << strerror(errno) << std::endl;
+            exit(1);
+        }
+
+        line += n;
+        len -= n;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    if (argc == 3 && strcmp(argv[2], "shutdown") == 0) {
+        // handled below as a job with no file
+    } else if (argc < 4) {
+        std::cerr << "usage: convert_client socket exchange file [file...]" << std::endl;
+        std::cerr << "       convert_client socket shutdown" << std::endl;
+        exit(1);
+    }
+
+    std::vector<int> fds;
+    char line[N_JOB];
+
+    if (argc == 3) {
+        int fd = connect_server(argv[1]);
+        send_line(fd, "shutdown\n");
+        fds.push_back(fd);
+    }
+
+    // the server opens the files, so pass absolute paths.
+    // resolve all of them first, nothing is sent if one is missing
+    std::vector<char *> paths;
+
+    for (int i = 3; i < argc; i++) {
+        char *path = realpath(argv[i], NULL);
+
+        if (path == NULL) {
+            std::cerr << "no such file: " << argv[i] << std::endl;
+            exit(1);
+        }
+
+        paths.push_back(path);
+    }
+
+    for (size_t i = 0; i < paths.size(); i++) {
+        int fd = connect_server(argv[1]);
+
+        snprintf(line, N_JOB, "%s %s\n", argv[2], paths[i]);
+        send_line(fd, line);
+        fds.push_back(fd);
+
+        free(paths[i]);
+    }
+
+    for (size_t i = 0; i < fds.size(); i++) {
+        ssize_t n;
+
+        if (argc > 3) {
+            std::cout << argv[i + 3] << ": ";
+        }
+
+        while ((n = read(fds[i], line, N_JOB)) > 0) {
+            std::cout.write(line, n);
+        }
+
+        close(fds[i]);
+    }
+
+    return 0;
+}
@@ -1,10 +1,44 @@
 #include <string.h>
 #include <iostream>
+#include <map>
+#include <set>
+#include <string>
 #include <sqlite3.h>
 
 #include "common.h"
+#include "eventlog.h"
+#include "extsort.h"
+#include "conflate.h"
+#include "stats.h"
+#include "unified.h"
+#include "trace.h"
+
+// tables already created by this process, a server sees the same tables over and over
+std::set<std::string> created_tables;
+
+bool nanosec_timestamps = false;
+
+// insert statements of trade and book tables, prepared for this connection,
+// staging may switch to another one
+static sqlite3 *level_db = NULL;
+static std::map<std::string, sqlite3_stmt *> level_statements;
+// rows of a table usually come in runs, skip the map lookup for those
+static std::string last_level_table;
+static sqlite3_stmt *last_level_stmt = NULL;
 
 void create_new_table(sqlite3 *db, TableType table_type, const char *table_name) {
+    eventlog_channel(table_type, table_name);
+
+    if (unified_enabled()) {
+        // no table of its own, only an id in the unified tables
+        unified_channel(db, table_name);
+        return;
+    }
+
+    if (created_tables.count(table_name) > 0) {
+        return;
+    }
+
     const char *table_definition;
 
     if (table_type == Trade) {
@@ -52,4 +86,153 @@ void create_new_table(sqlite3 *db, TableType table_type, const char *table_name)
     }
 
     free(sql);
+
+    created_tables.insert(table_name);
+
+    trace_instant("create_table", table_name);
+}
+
+void insert_trade(sqlite3 *db, const char *table_name, unsigned long long timestamp, double price, double size) {
+    eventlog_trade(table_name, timestamp, price, size);
+
+    if (extsort_enabled()) {
+        extsort_trade(table_name, timestamp, price, size);
+        return;
+    }
+
+    write_trade(db, table_name, timestamp, price, size);
+}
+
+void insert_book(sqlite3 *db, const char *table_name, unsigned long long timestamp, double price, double size) {
+    eventlog_book(table_name, timestamp, price, size);
+
+    if (conflate_enabled()) {
+        conflate_book(db, table_name, timestamp, price, size);
+        return;
+    }
+
+    store_book(db, table_name, timestamp, price, size);
+}
+
+void store_book(sqlite3 *db, const char *table_name, unsigned long long timestamp, double price, double size) {
+    if (extsort_enabled()) {
+        extsort_book(table_name, timestamp, price, size);
+        return;
+    }
+
+    write_book(db, table_name, timestamp, price, size);
+}
+
+void insert_ticker(sqlite3 *db, const char *table_name, unsigned long long timestamp, const TickerData &ticker) {
+    eventlog_ticker(table_name, timestamp, ticker);
+
+    if (extsort_enabled()) {
+        extsort_ticker(table_name, timestamp, ticker);
+        return;
+    }
+
+    write_ticker(db, table_name, timestamp, ticker);
+}
+
+sqlite3_stmt *level_statement(sqlite3 *db, const char *table_name) {
+    if (db != level_db) {
+        for (auto i = level_statements.begin(); i != level_statements.end(); i++) {
+            sqlite3_finalize(i->second);
+        }
+        level_statements.clear();
+        last_level_stmt = NULL;
+
+        level_db = db;
+    }
+
+    if (last_level_stmt != NULL && last_level_table == table_name) {
+        return last_level_stmt;
+    }
+
+    sqlite3_stmt *&stmt = level_statements[table_name];
+
+    if (stmt == NULL) {
+        char sql[N_SQL];
+
+        snprintf(sql, N_SQL, "INSERT INTO '%s' VALUES(?, ?, ?)", table_name);
+
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+            std::cerr << "sqlite error: " << sqlite3_errmsg(db) << std::endl;
+            exit(1);
+        }
+    }
+
+    last_level_table = table_name;
+    last_level_stmt = stmt;
+
+    return stmt;
+}
+
+// trade and book tables have the same columns
+static void write_level(sqlite3 *db, const char *table_name, unsigned long long timestamp, double price, double size) {
+    sqlite3_stmt *stmt = level_statement(db, table_name);
+
+    sqlite3_bind_int64(stmt, 1, timestamp);
+    sqlite3_bind_double(stmt, 2, price);
+    sqlite3_bind_double(stmt, 3, size);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        std::cerr << "sqlite error: " << sqlite3_errmsg(db) << std::endl;
+        exit(1);
+    }
+
+    sqlite3_reset(stmt);
+
+    stats_row(table_name, sqlite3_last_insert_rowid(db), timestamp, price);
+}
+
+void write_trade(sqlite3 *db, const char *table_name, unsigned long long timestamp, double price, double size) {
+    TraceSpan span(TraceInsert);
+
+    if (unified_enabled()) {
+        unified_trade(db, table_name, timestamp, price, size);
+        return;
+    }
+
+    write_level(db, table_name, timestamp, price, size);
+}
+
+void write_book(sqlite3 *db, const char *table_name, unsigned long long timestamp, double price, double size) {
+    TraceSpan span(TraceInsert);
+
+    if (unified_enabled()) {
+        unified_book(db, table_name, timestamp, price, size);
+        return;
+    }
+
+    write_level(db, table_name, timestamp, price, size);
+}
+
+void write_ticker(sqlite3 *db, const char *table_name, unsigned long long timestamp, const TickerData &ticker) {
+    TraceSpan span(TraceInsert);
+
+    if (unified_enabled()) {
+        unified_ticker(db, table_name, timestamp, ticker);
+        return;
+    }
+
+    char sql[N_SQL];
+
+    snprintf(sql, N_SQL,
+        "INSERT INTO '%s' VALUES(%llu, %.10f, %.7f, %.12f, %.10f, %.7f, %.12f, %.10f, %.12f, %.12f)",
+        table_name,
+        timestamp,
+        ticker.best_bid,
+        ticker.best_bid_size,
+        ticker.total_bid_depth,
+        ticker.best_ask,
+        ticker.best_ask_size,
+        ticker.total_ask_depth,
+        ticker.last_traded_price,
+        ticker.volume,
+        ticker.volume_by_product);
+
+    execute_sql(db, sql);
+
+    stats_row(table_name, sqlite3_last_insert_rowid(db), timestamp, ticker.last_traded_price);
 }
@@ -20,9 +20,42 @@ enum TableType{
     Ticker,
 };
 
+struct TickerData {
+    double best_bid;
+    double best_bid_size;
+    double total_bid_depth;
+    double best_ask;
+    double best_ask_size;
+    double total_ask_depth;
+    double last_traded_price;
+    double volume;
+    double volume_by_product;
+};
+
+// store bitfinex trade and bitflyer times in nanoseconds (-n). off by default since
+// earlier converts stored them in other units, and appending must not mix units in a table
+extern bool nanosec_timestamps;
+
 void create_new_table(sqlite3 *db, TableType table_type, const char *table_name);
 
-inline void execute_insert(sqlite3 *db, const char *sql) {
+// output stage, every row any exchange produces is passed to one of these
+void insert_trade(sqlite3 *db, const char *table_name, unsigned long long timestamp, double price, double size);
+void insert_book(sqlite3 *db, const char *table_name, unsigned long long timestamp, double price, double size);
+void insert_ticker(sqlite3 *db, const char *table_name, unsigned long long timestamp, const TickerData &ticker);
+
+// book rows after conflation
+void store_book(sqlite3 *db, const char *table_name, unsigned long long timestamp, double price, double size);
+
+// last step of the output stage, writes a row into the database
+void write_trade(sqlite3 *db, const char *table_name, unsigned long long timestamp, double price, double size);
+void write_book(sqlite3 *db, const char *table_name, unsigned long long timestamp, double price, double size);
+void write_ticker(sqlite3 *db, const char *table_name, unsigned long long timestamp, const TickerData &ticker);
+
+// cached single row insert into a trade or book table for this connection
+sqlite3_stmt *level_statement(sqlite3 *db, const char *table_name);
+
+// run sql that returns no rows, exits on error
+inline void execute_sql(sqlite3 *db, const char *sql) {
     int r;
     char *err;
 
@@ -1,2 +1,2 @@
-c++ common.cpp convert.cpp bitflyer.cpp bitfinex.cpp bitmex.cpp -g -Wall -lsqlite3 -O1 -o convert
-
+c++ common.cpp convert.cpp bitflyer.cpp bitfinex.cpp bitmex.cpp staging.cpp eventlog.cpp extsort.cpp server.cpp conflate.cpp stats.cpp unified.cpp latency.cpp dedup.cpp trace.cpp batch.cpp -g -Wall -pthread -lsqlite3 -O1 -o convert
+c++ client.cpp -g -Wall -O1 -o convert_client
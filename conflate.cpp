@@ -0,0 +1,73 @@
+#include <cmath>
+#include <map>
+#include <string>
+#include <utility>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "conflate.h"
+
+struct TableBucket {
+    unsigned long long bucket;
+    // final size of every level changed in the bucket, by side and price.
+    // side is the sign bit of the size, a cleared ask is -0.0 and must not replace a bid
+    std::map<std::pair<bool, double>, double> levels;
+};
+
+static bool enabled = false;
+static unsigned long long bucket_length;
+// every table has its own bucket, tables of another symbol or exchange may be at another time
+static std::map<std::string, TableBucket> tables;
+
+// rows of a bucket are stamped with its end, they show the book as it is at that time
+static void flush(sqlite3 *db, const std::string &table_name, TableBucket &table) {
+    unsigned long long timestamp = (table.bucket + 1) * bucket_length;
+
+    for (auto level = table.levels.begin(); level != table.levels.end(); level++) {
+        store_book(db, table_name.c_str(), timestamp, level->first.second, level->second);
+    }
+
+    table.levels.clear();
+}
+
+void conflate_open(unsigned long long resolution) {
+    bucket_length = resolution;
+    enabled = true;
+}
+
+bool conflate_enabled() {
+    return enabled;
+}
+
+void conflate_book(sqlite3 *db, const char *table_name, unsigned long long timestamp, double price, double size) {
+    unsigned long long bucket = timestamp / bucket_length;
+
+    auto found = tables.find(table_name);
+
+    if (found == tables.end()) {
+        found = tables.insert(std::make_pair(std::string(table_name), TableBucket{bucket})).first;
+    }
+
+    TableBucket &table = found->second;
+
+    if (bucket > table.bucket) {
+        flush(db, found->first, table);
+        table.bucket = bucket;
+    }
+    // updates from an earlier bucket can not be placed anymore and go into the current one
+
+    table.levels[std::make_pair((bool) std::signbit(size), price)] = size;
+}
+
+void conflate_finish(sqlite3 *db) {
+    if (!enabled) {
+        return;
+    }
+
+    for (auto table = tables.begin(); table != tables.end(); table++) {
+        flush(db, table->first, table->second);
+    }
+
+    // the next input starts over, it may cover an earlier time
+    tables.clear();
+}
@@ -0,0 +1,19 @@
+#ifndef CONFLATE_H
+#define CONFLATE_H
+
+#include <sqlite3.h>
+
+// coalesces book updates to the same price level within fixed time buckets,
+// writing only the final size of each level changed at the end of every bucket
+
+// resolution is the bucket length in nanosec
+void conflate_open(unsigned long long resolution);
+
+bool conflate_enabled();
+
+void conflate_book(sqlite3 *db, const char *table_name, unsigned long long timestamp, double price, double size);
+
+// write levels of the bucket still open
+void conflate_finish(sqlite3 *db);
+
+#endif
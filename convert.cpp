@@ -1,5 +1,9 @@
 #include <ctime>
+#include <fstream>
 #include <iostream>
+#include <queue>
+#include <vector>
+#include <unistd.h>
 #include <sqlite3.h>
 #include <rapidjson/document.h>
 
@@ -7,6 +11,16 @@
 #include "bitflyer.h"
 #include "bitfinex.h"
 #include "bitmex.h"
+#include "staging.h"
+#include "eventlog.h"
+#include "extsort.h"
+#include "server.h"
+#include "conflate.h"
+#include "stats.h"
+#include "unified.h"
+#include "latency.h"
+#include "dedup.h"
+#include "trace.h"
 
 using namespace rapidjson;
 
@@ -40,103 +54,508 @@ inline sqlite3 *connect_database(char *filename) {
     return db;
 }
 
-int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        std::cerr << "argc == 3" << std::endl;
-        exit(1);
+// commit and start a new transaction, returns the connection to keep writing into
+inline sqlite3 *next_transaction(sqlite3 *db) {
+    {
+        TraceSpan span(TraceCommit);
+
+        // statistics of rows written so far go into the same transaction
+        stats_flush(db);
+        latency_flush(db, false);
+
+        commit(db);
+    }
+
+    // let staging copy to the destination, may switch db to the destination
+    db = staging_checkpoint(db);
+
+    start_transaction(db);
+
+    trace_batch();
+
+    return db;
+}
+
+// number of lines between commits, 0 for an unknown exchange
+unsigned int commit_interval_of(const char *exchange) {
+    if (strcmp(exchange, "bitfinex") == 0) {
+        return 1000000;
+
+    } else if (strcmp(exchange, "bitmex") == 0) {
+        return 100000;
+
+    } else if (strcmp(exchange, "bitflyer") == 0) {
+        return 100000;
+
+    } else if (strcmp(exchange, "eventlog") == 0) {
+        // counted in rows instead of lines
+        return 1000000;
     }
 
-    // setup commit interval
-    unsigned int commit_interval;
-    if (strcmp(argv[2], "bitfinex") == 0) {
-        commit_interval = 1000000;
+    return 0;
+}
+
+enum LineType {
+    LineOther,
+    LineMsg,
+    LineEmit,
+};
+
+// read a line of a capture, leaving the message in buf. returns false at the end of in
+bool read_line(std::istream &in, char *buf, LineType *type, unsigned long long *line_timestamp) {
+    TraceSpan span(TraceRead);
+
+    if (!in.getline(buf, N_L, ',')) {
+        return false;
+    }
 
-    } else if (strcmp(argv[2], "bitmex") == 0) {
-        commit_interval = 100000;
+    if (buf[0] == 'm' && buf[1] == 's' && buf[2] == 'g') {
+        *type = LineMsg;
 
-    } else if (strcmp(argv[2], "bitflyer") == 0) {
-        commit_interval = 100000;
+    } else if (buf[0] == 'e' && buf[1] == 'm' && buf[2] == 'i' && buf[3] == 't') {
+        *type = LineEmit;
 
     } else {
-        std::cerr << "unknown exchange name" << std::endl;
-        exit(1);
+        *type = LineOther;
+        in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+
+        return true;
     }
 
-    // open database
-    sqlite3 *db = connect_database(argv[1]);
-    
-    /* start reading */
-    // buffer for storing an line
-    char* buf = (char*) std::malloc(sizeof(char)*N_L);
-    // initialize buffer
-    memset(buf, 0, N_L);
+    // read timestamp
+    in.getline(buf, N_L, ',');
+    *line_timestamp = timestamp_nanosec(buf);
+
+    // rest of the line is a msg
+    in.getline(buf, N_L);
+
+    return true;
+}
+
+void handle_line(sqlite3 *db, const char *exchange, LineType type, unsigned long long line_timestamp,
+    char *buf, Document &doc) {
+
+    {
+        TraceSpan span(TraceParse);
+
+        // setting kParseFullPrecisionFlag to obitain price and size in full precision
+        doc.Parse<kParseFullPrecisionFlag>(buf);
+    }
+
+    TraceSpan span(TraceHandler);
+
+    if (type == LineMsg) {
+        if (strcmp(exchange, "bitfinex") == 0) {
+            bitfinex_msg(db, line_timestamp, doc);
+
+        } else if (strcmp(exchange, "bitmex") == 0) {
+            bitmex_msg(db, line_timestamp, doc);
+            
+        } else if (strcmp(exchange, "bitflyer") == 0) {
+            bitflyer_msg(db, line_timestamp, doc);
+        }
+    } else if (type == LineEmit) {
+        if (strcmp(exchange, "bitfinex") == 0) {
+            bitfinex_emit(db, line_timestamp, doc);
+            
+        } else if (strcmp(exchange, "bitmex") == 0) {
+            bitmex_emit(db, line_timestamp, doc);
+            
+        } else if (strcmp(exchange, "bitflyer") == 0) {
+            bitflyer_emit(db, line_timestamp, doc);
+        }
+    }
+}
+
+// convert a capture read from in, returns the connection writes ended up in
+sqlite3 *convert_capture(sqlite3 *db, std::istream &in, const char *exchange,
+    unsigned int commit_interval, unsigned long long *num_line) {
+
+    // buffer for storing an line, kept between jobs of a server
+    static char *buf = NULL;
     // json parser
-    Document doc;
+    static Document doc;
+    LineType type;
     unsigned long long line_timestamp;
-    unsigned long long num_line = 0;
+
+    if (buf == NULL) {
+        buf = (char*) std::malloc(sizeof(char)*N_L);
+        // initialize buffer
+        memset(buf, 0, N_L);
+    }
 
     // skip head
-    std::cin.getline(buf, N_L);
+    in.getline(buf, N_L);
 
-    // setup transaction
-    start_transaction(db);
+    while (read_line(in, buf, &type, &line_timestamp)) {
+        if (type != LineOther) {
+            handle_line(db, exchange, type, line_timestamp, buf, doc);
+        }
 
-    while (std::cin.getline(buf, N_L, ',')) {
-        if (buf[0] == 'm' && buf[1] == 's' && buf[2] == 'g') {
-            // read timestamp
-            std::cin.getline(buf, N_L, ',');
-            line_timestamp = timestamp_nanosec(buf);
-
-            // rest of the line is a msg
-            std::cin.getline(buf, N_L);
-            // setting kParseFullPrecisionFlag to obitain price and size in full precision
-            doc.Parse<kParseFullPrecisionFlag>(buf);
-
-            if (strcmp(argv[2], "bitfinex") == 0) {
-                bitfinex_msg(db, line_timestamp, doc);
-
-            } else if (strcmp(argv[2], "bitmex") == 0) {
-                bitmex_msg(db, line_timestamp, doc);
-                
-            } else if (strcmp(argv[2], "bitflyer") == 0) {
-                bitflyer_msg(db, line_timestamp, doc);
-            }
-        } else if (buf[0] == 'e' && buf[1] == 'm' && buf[2] == 'i' && buf[3] == 't') {
-            std::cin.getline(buf, N_L, ',');
-            line_timestamp = timestamp_nanosec(buf);
+        // expect a next line
+        (*num_line)++;
 
-            std::cin.getline(buf, N_L);
-            doc.Parse<kParseFullPrecisionFlag>(buf);
-            
-            if (strcmp(argv[2], "bitfinex") == 0) {
-                bitfinex_emit(db, line_timestamp, doc);
-                
-            } else if (strcmp(argv[2], "bitmex") == 0) {
-                bitmex_emit(db, line_timestamp, doc);
-                
-            } else if (strcmp(argv[2], "bitflyer") == 0) {
-                bitflyer_emit(db, line_timestamp, doc);
+        if (*num_line % commit_interval == 0) {
+            db = next_transaction(db);
+        }
+    }
+
+    return db;
+}
+
+struct Capture {
+    std::istream *in;
+    char *buf;
+    LineType type;
+    unsigned long long line_timestamp;
+};
+
+// read the next msg or emit line of a capture, returns false at its end
+bool next_line(Capture &capture) {
+    while (read_line(*capture.in, capture.buf, &capture.type, &capture.line_timestamp)) {
+        if (capture.type != LineOther) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// identifies a message delivered by every capture, 0 if it must never be dropped
+uint64_t message_fingerprint(const char *exchange, unsigned int source, LineType type, const char *msg) {
+    if (type != LineMsg) {
+        // requests sent by the recorder itself
+        return 0;
+    }
+
+    if (strcmp(exchange, "bitfinex") == 0) {
+        // events carry channel ids of their own connection, never drop them
+        if (msg[0] != '[') {
+            return 0;
+        }
+
+        // channel ids differ between connections, identify the channel by its name
+        const char *channel = bitfinex_channel_name(source, atoi(msg + 1));
+        const char *rest = strchr(msg, ',');
+
+        if (channel == NULL || rest == NULL) {
+            return 0;
+        }
+
+        return dedup_hash(rest, strlen(rest), dedup_hash(channel, strlen(channel)));
+    }
+
+    return dedup_hash(msg, strlen(msg));
+}
+
+// merge captures of the same exchange recorded in parallel on line timestamps,
+// dropping messages and trades more than one of them delivered.
+// returns the connection writes ended up in
+sqlite3 *convert_merged(sqlite3 *db, std::vector<std::istream *> &ins, const char *exchange,
+    unsigned int commit_interval, unsigned long long *num_line) {
+
+    static Document doc;
+    std::vector<Capture> captures(ins.size());
+
+    auto later = [&captures](size_t a, size_t b) {
+        if (captures[a].line_timestamp != captures[b].line_timestamp) {
+            return captures[a].line_timestamp > captures[b].line_timestamp;
+        }
+        return a > b;
+    };
+    std::priority_queue<size_t, std::vector<size_t>, decltype(later)> queue(later);
+
+    for (size_t i = 0; i < captures.size(); i++) {
+        captures[i].in = ins[i];
+        captures[i].buf = (char*) std::malloc(sizeof(char)*N_L);
+        memset(captures[i].buf, 0, N_L);
+
+        // skip head
+        captures[i].in->getline(captures[i].buf, N_L);
+
+        if (next_line(captures[i])) {
+            queue.push(i);
+        }
+    }
+
+    while (!queue.empty()) {
+        size_t i = queue.top();
+        queue.pop();
+
+        Capture &capture = captures[i];
+        uint64_t fingerprint = message_fingerprint(exchange, i, capture.type, capture.buf);
+
+        if (fingerprint == 0 || !dedup_message(fingerprint, i, capture.line_timestamp)) {
+            bitfinex_set_source(i);
+            handle_line(db, exchange, capture.type, capture.line_timestamp, capture.buf, doc);
+        }
+
+        (*num_line)++;
+
+        if (*num_line % commit_interval == 0) {
+            db = next_transaction(db);
+        }
+
+        if (next_line(capture)) {
+            queue.push(i);
+        }
+    }
+
+    for (auto i = captures.begin(); i != captures.end(); i++) {
+        free(i->buf);
+    }
+
+    bitfinex_set_source(0);
+
+    return db;
+}
+
+// re-convert an event log read from in, returns the connection writes ended up in
+sqlite3 *convert_eventlog(sqlite3 *db, FILE *in, unsigned int commit_interval, unsigned long long *num_record) {
+    eventlog_replay_start(in);
+
+    while (eventlog_replay(db, in)) {
+        (*num_record)++;
+
+        if (*num_record % commit_interval == 0) {
+            db = next_transaction(db);
+        }
+    }
+
+    return db;
+}
+
+// convert the files at paths, or stdin if there are none, in a transaction of their own.
+// more than one capture is merged. returns the connection writes ended up in
+sqlite3 *run_job(sqlite3 *db, const char *exchange, const std::vector<const char *> &paths,
+    unsigned long long *num_line, const char **error) {
+
+    unsigned int commit_interval = commit_interval_of(exchange);
+
+    if (commit_interval == 0) {
+        *error = "unknown exchange name";
+        return db;
+    }
+
+    if (strcmp(exchange, "eventlog") == 0) {
+        if (paths.size() > 1) {
+            *error = "event logs can not be merged";
+            return db;
+        }
+
+        FILE *in = paths.empty() ? stdin : fopen(paths[0], "rb");
+
+        if (in == NULL) {
+            *error = "could not open file";
+            return db;
+        }
+
+        start_transaction(db);
+        db = convert_eventlog(db, in, commit_interval, num_line);
+
+        if (in != stdin) {
+            fclose(in);
+        }
+    } else {
+        std::vector<std::ifstream> files(paths.size());
+        std::vector<std::istream *> ins;
+
+        for (size_t i = 0; i < paths.size(); i++) {
+            files[i].open(paths[i]);
+
+            if (!files[i].is_open()) {
+                *error = "could not open file";
+                return db;
             }
+
+            ins.push_back(&files[i]);
+        }
+
+        start_transaction(db);
+
+        if (ins.size() > 1) {
+            db = convert_merged(db, ins, exchange, commit_interval, num_line);
         } else {
-            std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+            db = convert_capture(db, ins.empty() ? std::cin : *ins[0], exchange, commit_interval, num_line);
         }
+    }
 
-        // expect a next line
-        num_line++;
+    // the last bucket of conflated books
+    conflate_finish(db);
+
+    // sorted rows are only written now
+    db = extsort_finish(db, commit_interval, next_transaction);
+
+    // commit all
+    {
+        TraceSpan span(TraceCommit);
+
+        stats_flush(db);
+        latency_flush(db, true);
+        commit(db);
+    }
+
+    trace_batch();
+
+    return db;
+}
+
+// a job sent to the server, flushes staging after each one
+sqlite3 *run_server_job(sqlite3 *db, const char *exchange, const char *path,
+    unsigned long long *num_line, const char **error) {
+
+    db = run_job(db, exchange, std::vector<const char *>(1, path), num_line, error);
+
+    return staging_flush(db);
+}
 
-        if (num_line % commit_interval == 0) {
-            // commit before and start a new transaction
-            commit(db);
+void usage() {
+    std::cerr << "usage: convert [-s staging] [-m budget_mb] [-e eventlog] [-S sort_mb]" << std::endl;
+    std::cerr << "               [-c ms] [-u] [-L] [-H] [-w ms] [-t trace] [-n]" << std::endl;
+    std::cerr << "               database exchange [capture...]" << std::endl;
+    std::cerr << "       convert [options] -l socket database" << std::endl;
+    std::cerr << "  -s staging    write into a staging database (:memory: or a file on tmpfs)" << std::endl;
+    std::cerr << "                and copy it to database in the background about once a minute" << std::endl;
+    std::cerr << "  -m budget_mb  maximum size of the staging database" << std::endl;
+    std::cerr << "  -e eventlog   also write every row into a binary event log," << std::endl;
+    std::cerr << "                convert it again later with exchange \"eventlog\"" << std::endl;
+    std::cerr << "  -S sort_mb    write every table in timestamp order, buffering rows in" << std::endl;
+    std::cerr << "                sort_mb of memory and spilling to temporary files" << std::endl;
+    std::cerr << "  -c ms         write only the final size of each book level changed" << std::endl;
+    std::cerr << "                within ms long buckets, at the end of the bucket" << std::endl;
+    std::cerr << "  -u            write into single trades, book and ticker tables with" << std::endl;
+    std::cerr << "                exchange and symbol ids instead of a table per channel" << std::endl;
+    std::cerr << "  -L            print receive minus exchange time percentiles per channel" << std::endl;
+    std::cerr << "  -H            -L and also write a latency histogram per channel and" << std::endl;
+    std::cerr << "                minute into _latency" << std::endl;
+    std::cerr << "  -w ms         captures given are read instead of stdin, more than one" << std::endl;
+    std::cerr << "                is merged dropping what they both delivered within ms" << std::endl;
+    std::cerr << "                of each other, 5000 by default" << std::endl;
+    std::cerr << "  -t trace      write a chrome trace-event timeline of every batch and" << std::endl;
+    std::cerr << "                of stalls into trace, open it in perfetto" << std::endl;
+    std::cerr << "  -n            store bitfinex trade and bitflyer times in nanoseconds, they are" << std::endl;
+    std::cerr << "                in other units without it, do not append across the two" << std::endl;
+    std::cerr << "  -l socket     stay running and convert files sent as \"<exchange> <path>\"" << std::endl;
+    std::cerr << "                to a unix domain socket, see convert_client. a job failing on" << std::endl;
+    std::cerr << "                bad input stops the server, queued jobs are answered with an error" << std::endl;
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    const char *staging_path = NULL;
+    unsigned long long staging_budget = 0;
+    const char *eventlog_path = NULL;
+    unsigned long long sort_budget = 0;
+    const char *socket_path = NULL;
+    unsigned long long conflate_ms = 0;
+    unsigned long long window_ms = 5000;
+    int opt;
 
-            // start a new transaction
-            start_transaction(db);
+    while ((opt = getopt(argc, argv, "s:m:e:S:l:c:uLHw:t:n")) != -1) {
+        switch (opt) {
+        case 's':
+            staging_path = optarg;
+            break;
+        case 'm':
+            staging_budget = strtoull(optarg, NULL, 10) * 1024 * 1024;
+            break;
+        case 'e':
+            eventlog_path = optarg;
+            break;
+        case 'S':
+            sort_budget = strtoull(optarg, NULL, 10) * 1024 * 1024;
+            break;
+        case 'l':
+            socket_path = optarg;
+            break;
+        case 'c':
+            conflate_ms = strtoull(optarg, NULL, 10);
+            break;
+        case 'u':
+            unified_open();
+            break;
+        case 'L':
+            latency_open(false);
+            break;
+        case 'H':
+            latency_open(true);
+            break;
+        case 'w':
+            window_ms = strtoull(optarg, NULL, 10);
+            break;
+        case 't':
+            trace_open(optarg);
+            trace_thread("main");
+            break;
+        case 'n':
+            nanosec_timestamps = true;
+            break;
+        default:
+            usage();
         }
     }
 
-    // commit all
-    commit(db);
+    if (socket_path == NULL ? argc - optind < 2 : argc - optind != 1) {
+        usage();
+    }
+
+    char *db_name = argv[optind];
+    char *exchange = argv[optind + 1];
+
+    if (socket_path == NULL && commit_interval_of(exchange) == 0) {
+        std::cerr << "unknown exchange name" << std::endl;
+        exit(1);
+    }
+
+    // open database
+    sqlite3 *dest = connect_database(db_name);
+    sqlite3 *db = dest;
+
+    if (staging_path != NULL) {
+        db = staging_open(staging_path, dest, staging_budget);
+    }
+
+    if (eventlog_path != NULL) {
+        eventlog_open(eventlog_path);
+    }
+
+    if (sort_budget > 0) {
+        extsort_open(sort_budget);
+    }
+
+    if (conflate_ms > 0) {
+        conflate_open(conflate_ms * 1000000);
+    }
+
+    if (socket_path != NULL) {
+        db = serve(socket_path, db, run_server_job);
+    } else {
+        const char *error = NULL;
+        unsigned long long num_line = 0;
+        std::vector<const char *> captures(argv + optind + 2, argv + argc);
 
-    sqlite3_close_v2(db);
+        if (captures.size() > 1) {
+            dedup_open(window_ms * 1000000, captures.size());
+        }
+
+        db = run_job(db, exchange, captures, &num_line, &error);
+
+        if (error != NULL) {
+            std::cerr << error << std::endl;
+            exit(1);
+        }
+    }
+
+    latency_report();
+
+    eventlog_close();
+
+    staging_close(db);
+
+    // every other thread is done now
+    trace_close();
+
+    sqlite3_close_v2(dest);
 
     return 0;
-}
\ No newline at end of file
+}
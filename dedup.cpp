@@ -0,0 +1,117 @@
+#include <string.h>
+#include <iostream>
+#include <deque>
+#include <unordered_map>
+
+#include "dedup.h"
+
+struct MessageEntry {
+    // times each capture delivered the message within the window
+    uint8_t counts[N_SOURCE];
+    unsigned long long last_seen;
+};
+
+struct Seen {
+    unsigned long long timestamp;
+    uint64_t fingerprint;
+};
+
+static bool enabled = false;
+static unsigned long long window_length;
+static unsigned int sources;
+
+static std::unordered_map<uint64_t, MessageEntry> messages;
+static std::deque<Seen> message_order;
+static std::unordered_map<uint64_t, unsigned long long> trades;
+static std::deque<Seen> trade_order;
+
+// forget fingerprints last seen before the window
+template <typename Map>
+static void expire(Map &map, std::deque<Seen> &order, unsigned long long timestamp,
+    unsigned long long (*last_seen)(const typename Map::mapped_type &)) {
+
+    while (!order.empty() && order.front().timestamp + window_length < timestamp) {
+        auto found = map.find(order.front().fingerprint);
+
+        // only the latest sighting removes the entry
+        if (found != map.end() && last_seen(found->second) == order.front().timestamp) {
+            map.erase(found);
+        }
+
+        order.pop_front();
+    }
+}
+
+static unsigned long long message_last_seen(const MessageEntry &entry) {
+    return entry.last_seen;
+}
+
+static unsigned long long trade_last_seen(const unsigned long long &timestamp) {
+    return timestamp;
+}
+
+void dedup_open(unsigned long long window, unsigned int n_sources) {
+    if (n_sources > N_SOURCE) {
+        std::cerr << "dedup: at most " << N_SOURCE << " captures can be merged" << std::endl;
+        exit(1);
+    }
+
+    window_length = window;
+    sources = n_sources;
+    enabled = true;
+}
+
+bool dedup_enabled() {
+    return enabled;
+}
+
+bool dedup_message(uint64_t fingerprint, unsigned int source, unsigned long long timestamp) {
+    if (!enabled) {
+        return false;
+    }
+
+    expire(messages, message_order, timestamp, message_last_seen);
+
+    auto found = messages.find(fingerprint);
+
+    if (found == messages.end()) {
+        MessageEntry entry;
+        memset(&entry, 0, sizeof(MessageEntry));
+        found = messages.emplace(fingerprint, entry).first;
+    }
+
+    MessageEntry &entry = found->second;
+    uint8_t most = 0;
+
+    for (unsigned int i = 0; i < sources; i++) {
+        if (i != source && entry.counts[i] > most) {
+            most = entry.counts[i];
+        }
+    }
+
+    bool duplicate = entry.counts[source] < most;
+
+    if (entry.counts[source] < 255) {
+        entry.counts[source]++;
+    }
+    entry.last_seen = timestamp;
+    message_order.push_back(Seen{timestamp, fingerprint});
+
+    return duplicate;
+}
+
+bool dedup_trade(uint64_t fingerprint, unsigned long long timestamp) {
+    if (!enabled) {
+        return false;
+    }
+
+    expire(trades, trade_order, timestamp, trade_last_seen);
+
+    auto found = trades.find(fingerprint);
+    bool duplicate = found != trades.end();
+
+    trades[fingerprint] = timestamp;
+    trade_order.push_back(Seen{timestamp, fingerprint});
+
+    return duplicate;
+}
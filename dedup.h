@@ -0,0 +1,37 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// drops messages and trades delivered by more than one of several captures merged together.
+// fingerprints are only remembered for window nanosec of receive time, so memory is bounded
+// by how far the captures are skewed apart
+
+#define N_SOURCE 8
+
+void dedup_open(unsigned long long window, unsigned int n_sources);
+
+bool dedup_enabled();
+
+// true if another capture already delivered this message as many times as source has now,
+// so it is a copy and must be skipped
+bool dedup_message(uint64_t fingerprint, unsigned int source, unsigned long long timestamp);
+
+// true if a trade with this fingerprint was seen within the window.
+// trades are compared on their own too since captures may batch them into messages differently
+bool dedup_trade(uint64_t fingerprint, unsigned long long timestamp);
+
+// fnv-1a
+inline uint64_t dedup_hash(const void *data, size_t len, uint64_t hash = 14695981039346656037ULL) {
+    const unsigned char *bytes = (const unsigned char *) data;
+
+    for (size_t i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+#endif
@@ -0,0 +1,213 @@
+#include <string.h>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "eventlog.h"
+
+// size of the stdio buffer for reading and writing logs
+#define N_EVENTLOG_BUF (1 << 20)
+
+static FILE *out = NULL;
+static uint32_t next_channel_id = 0;
+static std::map<std::string, uint32_t> channel_ids;
+
+// channel id to table name for the log being replayed
+static std::vector<std::string> replay_channels;
+
+static void write_or_die(const void *ptr, size_t size) {
+    if (fwrite(ptr, size, 1, out) != 1) {
+        std::cerr << "eventlog: write failed" << std::endl;
+        exit(1);
+    }
+}
+
+static void read_or_die(void *ptr, size_t size, FILE *in) {
+    if (fread(ptr, size, 1, in) != 1) {
+        std::cerr << "eventlog: truncated log" << std::endl;
+        exit(1);
+    }
+}
+
+// returns the id of the table, writing a channel record the first time it is seen
+static uint32_t intern(TableType table_type, const char *table_name) {
+    auto found = channel_ids.find(table_name);
+
+    if (found != channel_ids.end()) {
+        return found->second;
+    }
+
+    uint32_t id = next_channel_id++;
+    channel_ids[table_name] = id;
+
+    EventHeader header = { EventChannel, id, 0 };
+    ChannelEvent channel;
+
+    memset(&channel, 0, sizeof(ChannelEvent));
+    channel.table_type = table_type;
+    strncpy(channel.name, table_name, N_PAIR - 1);
+
+    write_or_die(&header, sizeof(EventHeader));
+    write_or_die(&channel, sizeof(ChannelEvent));
+
+    return id;
+}
+
+void eventlog_open(const char *filename) {
+    out = fopen(filename, "wb");
+
+    if (out == NULL) {
+        std::cerr << "eventlog: could not open " << filename << std::endl;
+        exit(1);
+    }
+
+    setvbuf(out, NULL, _IOFBF, N_EVENTLOG_BUF);
+
+    write_or_die(EVENTLOG_MAGIC, strlen(EVENTLOG_MAGIC));
+
+    uint32_t flags = nanosec_timestamps ? EVENTLOG_NANOSEC : 0;
+    write_or_die(&flags, sizeof(uint32_t));
+}
+
+void eventlog_close() {
+    if (out == NULL) {
+        return;
+    }
+
+    if (fclose(out) != 0) {
+        std::cerr << "eventlog: close failed" << std::endl;
+        exit(1);
+    }
+
+    out = NULL;
+}
+
+void eventlog_channel(TableType table_type, const char *table_name) {
+    if (out == NULL) {
+        return;
+    }
+
+    intern(table_type, table_name);
+}
+
+static void eventlog_level(EventType type, TableType table_type, const char *table_name,
+    unsigned long long timestamp, double price, double size) {
+
+    EventHeader header = { (uint32_t) type, intern(table_type, table_name), timestamp };
+    LevelEvent level = { price, size };
+
+    write_or_die(&header, sizeof(EventHeader));
+    write_or_die(&level, sizeof(LevelEvent));
+}
+
+void eventlog_trade(const char *table_name, unsigned long long timestamp, double price, double size) {
+    if (out == NULL) {
+        return;
+    }
+
+    eventlog_level(EventTrade, Trade, table_name, timestamp, price, size);
+}
+
+void eventlog_book(const char *table_name, unsigned long long timestamp, double price, double size) {
+    if (out == NULL) {
+        return;
+    }
+
+    eventlog_level(EventBook, Book, table_name, timestamp, price, size);
+}
+
+void eventlog_ticker(const char *table_name, unsigned long long timestamp, const TickerData &ticker) {
+    if (out == NULL) {
+        return;
+    }
+
+    EventHeader header = { EventTicker, intern(Ticker, table_name), timestamp };
+
+    write_or_die(&header, sizeof(EventHeader));
+    write_or_die(&ticker, sizeof(TickerData));
+}
+
+void eventlog_replay_start(FILE *in) {
+    char magic[sizeof(EVENTLOG_MAGIC)];
+
+    setvbuf(in, NULL, _IOFBF, N_EVENTLOG_BUF);
+
+    if (fread(magic, strlen(EVENTLOG_MAGIC), 1, in) != 1 ||
+        strncmp(magic, EVENTLOG_MAGIC, strlen(EVENTLOG_MAGIC)) != 0) {
+        std::cerr << "eventlog: not an event log, or one written by an older convert" << std::endl;
+        exit(1);
+    }
+
+    uint32_t flags;
+    read_or_die(&flags, sizeof(uint32_t), in);
+
+    // timestamps are replayed as they are, they must be in the units of the tables written
+    if (((flags & EVENTLOG_NANOSEC) != 0) != nanosec_timestamps) {
+        std::cerr << "eventlog: log was written " << (nanosec_timestamps ? "without" : "with")
+            << " -n, replay it " << (nanosec_timestamps ? "without" : "with") << " -n too" << std::endl;
+        exit(1);
+    }
+
+    // channel ids are only valid within a log
+    replay_channels.clear();
+}
+
+static const char *replay_channel(uint32_t channel_id) {
+    if (channel_id >= replay_channels.size()) {
+        std::cerr << "eventlog: undefined channel id " << channel_id << std::endl;
+        exit(1);
+    }
+
+    return replay_channels[channel_id].c_str();
+}
+
+bool eventlog_replay(sqlite3 *db, FILE *in) {
+    EventHeader header;
+
+    if (fread(&header, sizeof(EventHeader), 1, in) != 1) {
+        // end of the log
+        return false;
+    }
+
+    if (header.type == EventChannel) {
+        ChannelEvent channel;
+        read_or_die(&channel, sizeof(ChannelEvent), in);
+        channel.name[N_PAIR - 1] = '\0';
+
+        if (header.channel_id != replay_channels.size()) {
+            std::cerr << "eventlog: unexpected channel id " << header.channel_id << std::endl;
+            exit(1);
+        }
+
+        replay_channels.push_back(channel.name);
+
+        create_new_table(db, (TableType) channel.table_type, channel.name);
+
+    } else if (header.type == EventTrade || header.type == EventBook) {
+        LevelEvent level;
+        read_or_die(&level, sizeof(LevelEvent), in);
+
+        const char *table_name = replay_channel(header.channel_id);
+
+        if (header.type == EventTrade) {
+            insert_trade(db, table_name, header.timestamp, level.price, level.size);
+        } else {
+            insert_book(db, table_name, header.timestamp, level.price, level.size);
+        }
+
+    } else if (header.type == EventTicker) {
+        TickerData ticker;
+        read_or_die(&ticker, sizeof(TickerData), in);
+
+        insert_ticker(db, replay_channel(header.channel_id), header.timestamp, ticker);
+
+    } else {
+        std::cerr << "eventlog: unknown record type " << header.type << std::endl;
+        exit(1);
+    }
+
+    return true;
+}
@@ -0,0 +1,67 @@
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <sqlite3.h>
+
+#include "common.h"
+
+// binary log of everything passed to the output stage,
+// replaying it re-converts a capture without parsing json again
+
+// the magic is followed by a uint32 of flags
+#define EVENTLOG_MAGIC "CVEVLOG2"
+// timestamps are in the units of -n, see nanosec_timestamps
+#define EVENTLOG_NANOSEC 1
+
+enum EventType {
+    EventChannel = 1,
+    EventTrade,
+    EventBook,
+    EventTicker,
+};
+
+// every record starts with a header followed by a payload of fixed size for its type,
+// ChannelEvent, LevelEvent for trades and books, or TickerData
+struct EventHeader {
+    uint32_t type;
+    // interned table name, defined by an earlier channel record
+    uint32_t channel_id;
+    // as the output stage stores it, nanosec except for bitfinex trades and bitflyer
+    // without EVENTLOG_NANOSEC, those are in the units convert stores without -n
+    unsigned long long timestamp;
+};
+
+struct ChannelEvent {
+    uint32_t table_type;
+    char name[N_PAIR];
+};
+
+struct LevelEvent {
+    double price;
+    double size;
+};
+
+// start writing every row into filename
+void eventlog_open(const char *filename);
+
+void eventlog_close();
+
+// these do nothing unless eventlog_open is called
+void eventlog_channel(TableType table_type, const char *table_name);
+
+void eventlog_trade(const char *table_name, unsigned long long timestamp, double price, double size);
+
+void eventlog_book(const char *table_name, unsigned long long timestamp, double price, double size);
+
+void eventlog_ticker(const char *table_name, unsigned long long timestamp, const TickerData &ticker);
+
+// check the log header of in, must be called before eventlog_replay.
+// exits if the log was written with another -n than the one in effect
+void eventlog_replay_start(FILE *in);
+
+// pass the next record of in to the output stage, returns false at the end of the log
+bool eventlog_replay(sqlite3 *db, FILE *in);
+
+#endif
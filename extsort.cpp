@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <iostream>
+#include <algorithm>
+#include <map>
+#include <queue>
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "eventlog.h"
+#include "extsort.h"
+#include "unified.h"
+
+// stdio buffer of a run
+#define N_RUN_BUF (1 << 16)
+// runs merged at once, bounds open files and merge buffers to N_MERGE_FANIN per level
+#define N_MERGE_FANIN 16
+
+struct SortRecord {
+    // same header as event log records
+    EventHeader header;
+    // order of arrival, keeps rows with the same timestamp in their original order
+    unsigned long long seq;
+    union {
+        LevelEvent level;
+        TickerData ticker;
+    };
+};
+
+// rows of every channel share a table in the unified schema, then that table is sorted as a whole
+static bool by_table_type = false;
+
+static inline bool record_less(const SortRecord &a, const SortRecord &b) {
+    if (by_table_type) {
+        if (a.header.type != b.header.type) {
+            return a.header.type < b.header.type;
+        }
+    } else if (a.header.channel_id != b.header.channel_id) {
+        return a.header.channel_id < b.header.channel_id;
+    }
+    if (a.header.timestamp != b.header.timestamp) {
+        return a.header.timestamp < b.header.timestamp;
+    }
+    return a.seq < b.seq;
+}
+
+struct Run {
+    FILE *file;
+    // 0 for a spilled buffer, n + 1 for a merge of runs of level n
+    unsigned int level;
+};
+
+static bool enabled = false;
+static std::vector<SortRecord> buffer;
+static size_t capacity;
+static unsigned long long next_seq = 0;
+// sorted runs not merged yet, levels never increase towards the end
+static std::vector<Run> runs;
+
+static std::map<std::string, uint32_t> channel_ids;
+static std::vector<std::string> channel_names;
+
+static uint32_t intern(const char *table_name) {
+    auto found = channel_ids.find(table_name);
+
+    if (found != channel_ids.end()) {
+        return found->second;
+    }
+
+    uint32_t id = channel_names.size();
+    channel_ids[table_name] = id;
+    channel_names.push_back(table_name);
+
+    return id;
+}
+
+static FILE *new_run() {
+    // removed automatically when closed
+    FILE *run = tmpfile();
+
+    if (run == NULL) {
+        std::cerr << "extsort: could not create a temporary file" << std::endl;
+        exit(1);
+    }
+
+    setvbuf(run, NULL, _IOFBF, N_RUN_BUF);
+
+    return run;
+}
+
+static void write_run(FILE *run, const SortRecord *records, size_t n) {
+    if (fwrite(records, sizeof(SortRecord), n, run) != n) {
+        std::cerr << "extsort: write to a temporary file failed" << std::endl;
+        exit(1);
+    }
+}
+
+static bool read_record(FILE *run, SortRecord &record) {
+    return fread(&record, sizeof(SortRecord), 1, run) == 1;
+}
+
+struct HeadGreater {
+    const std::vector<SortRecord> *heads;
+
+    bool operator()(size_t a, size_t b) const {
+        return record_less((*heads)[b], (*heads)[a]);
+    }
+};
+
+// k-way merge of sorted runs
+class RunMerge {
+public:
+    RunMerge(std::vector<Run>::const_iterator begin, std::vector<Run>::const_iterator end)
+        : files(), heads(end - begin), queue(HeadGreater{&heads}) {
+
+        for (auto i = begin; i != end; i++) {
+            files.push_back(i->file);
+
+            if (read_record(i->file, heads[files.size() - 1])) {
+                queue.push(files.size() - 1);
+            }
+        }
+    }
+
+    bool next(SortRecord &record) {
+        if (queue.empty()) {
+            return false;
+        }
+
+        size_t i = queue.top();
+        queue.pop();
+
+        record = heads[i];
+
+        if (read_record(files[i], heads[i])) {
+            queue.push(i);
+        }
+
+        return true;
+    }
+
+private:
+    std::vector<FILE *> files;
+    std::vector<SortRecord> heads;
+    std::priority_queue<size_t, std::vector<size_t>, HeadGreater> queue;
+};
+
+// replace runs from first to the end with a single run merging them
+static void merge_tail(size_t first) {
+    FILE *merged = new_run();
+    unsigned int level = 0;
+    SortRecord record;
+
+    {
+        RunMerge merge(runs.begin() + first, runs.end());
+
+        while (merge.next(record)) {
+            write_run(merged, &record, 1);
+        }
+    }
+
+    for (size_t i = first; i < runs.size(); i++) {
+        level = std::max(level, runs[i].level);
+        fclose(runs[i].file);
+    }
+
+    rewind(merged);
+
+    runs.resize(first);
+    runs.push_back(Run{merged, level + 1});
+}
+
+static void spill() {
+    std::sort(buffer.begin(), buffer.end(), record_less);
+
+    FILE *run = new_run();
+    write_run(run, buffer.data(), buffer.size());
+    rewind(run);
+
+    runs.push_back(Run{run, 0});
+
+    buffer.clear();
+
+    // merge N_MERGE_FANIN runs of the same level into one of the next level,
+    // so every row is rewritten once per level and open runs grow only with the number of levels
+    while (runs.size() >= N_MERGE_FANIN) {
+        size_t first = runs.size() - N_MERGE_FANIN;
+
+        if (runs[first].level != runs.back().level) {
+            break;
+        }
+
+        merge_tail(first);
+    }
+}
+
+static inline SortRecord &next_record(EventType type, const char *table_name, unsigned long long timestamp) {
+    if (buffer.size() == capacity) {
+        spill();
+    }
+
+    buffer.emplace_back();
+
+    SortRecord &record = buffer.back();
+    record.header.type = type;
+    record.header.channel_id = intern(table_name);
+    record.header.timestamp = timestamp;
+    record.seq = next_seq++;
+
+    return record;
+}
+
+void extsort_open(unsigned long long budget) {
+    capacity = budget / sizeof(SortRecord);
+
+    if (capacity == 0) {
+        std::cerr << "extsort: memory budget too small" << std::endl;
+        exit(1);
+    }
+
+    buffer.reserve(capacity);
+    by_table_type = unified_enabled();
+    enabled = true;
+}
+
+bool extsort_enabled() {
+    return enabled;
+}
+
+void extsort_trade(const char *table_name, unsigned long long timestamp, double price, double size) {
+    SortRecord &record = next_record(EventTrade, table_name, timestamp);
+
+    record.level.price = price;
+    record.level.size = size;
+}
+
+void extsort_book(const char *table_name, unsigned long long timestamp, double price, double size) {
+    SortRecord &record = next_record(EventBook, table_name, timestamp);
+
+    record.level.price = price;
+    record.level.size = size;
+}
+
+void extsort_ticker(const char *table_name, unsigned long long timestamp, const TickerData &ticker) {
+    SortRecord &record = next_record(EventTicker, table_name, timestamp);
+
+    record.ticker = ticker;
+}
+
+static void write_record(sqlite3 *db, const SortRecord &record) {
+    const char *table_name = channel_names[record.header.channel_id].c_str();
+
+    if (record.header.type == EventTrade) {
+        write_trade(db, table_name, record.header.timestamp, record.level.price, record.level.size);
+
+    } else if (record.header.type == EventBook) {
+        write_book(db, table_name, record.header.timestamp, record.level.price, record.level.size);
+
+    } else {
+        write_ticker(db, table_name, record.header.timestamp, record.ticker);
+    }
+}
+
+sqlite3 *extsort_finish(sqlite3 *db, unsigned int commit_interval, sqlite3 *(*next_transaction)(sqlite3 *)) {
+    if (!enabled) {
+        return db;
+    }
+
+    unsigned long long num_row = 0;
+
+    if (runs.empty()) {
+        // everything fit in memory
+        std::sort(buffer.begin(), buffer.end(), record_less);
+
+        for (auto i = buffer.begin(); i != buffer.end(); i++) {
+            write_record(db, *i);
+
+            if (++num_row % commit_interval == 0) {
+                db = next_transaction(db);
+            }
+        }
+    } else {
+        spill();
+
+        // release the buffer, merging only needs a record per run
+        std::vector<SortRecord>().swap(buffer);
+
+        // runs left from lower levels, merge the smallest ones until a single pass can take them all
+        while (runs.size() > N_MERGE_FANIN) {
+            merge_tail(runs.size() - N_MERGE_FANIN);
+        }
+
+        SortRecord record;
+
+        {
+            RunMerge merge(runs.begin(), runs.end());
+
+            while (merge.next(record)) {
+                write_record(db, record);
+
+                if (++num_row % commit_interval == 0) {
+                    db = next_transaction(db);
+                }
+            }
+        }
+
+        for (auto i = runs.begin(); i != runs.end(); i++) {
+            fclose(i->file);
+        }
+        runs.clear();
+    }
+
+    buffer.clear();
+
+    return db;
+}
@@ -0,0 +1,27 @@
+#ifndef EXTSORT_H
+#define EXTSORT_H
+
+#include <sqlite3.h>
+
+#include "common.h"
+
+// buffers rows of the output stage in bounded memory, spilling sorted runs to temporary
+// files, then merges them so every table is written in timestamp order
+
+// budget is the memory used for buffering rows in bytes
+void extsort_open(unsigned long long budget);
+
+bool extsort_enabled();
+
+void extsort_trade(const char *table_name, unsigned long long timestamp, double price, double size);
+
+void extsort_book(const char *table_name, unsigned long long timestamp, double price, double size);
+
+void extsort_ticker(const char *table_name, unsigned long long timestamp, const TickerData &ticker);
+
+// merge everything buffered so far into the database, committing every commit_interval rows
+// with next_transaction. buffering starts over for rows added afterwards.
+// returns the connection writes ended up in
+sqlite3 *extsort_finish(sqlite3 *db, unsigned int commit_interval, sqlite3 *(*next_transaction)(sqlite3 *));
+
+#endif
@@ -0,0 +1,259 @@
+#include <string.h>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "latency.h"
+
+#define MINUTE 60000000000ULL
+
+struct Histogram {
+    unsigned long long counts[N_LATENCY_BUCKETS];
+    unsigned long long total;
+    // exchange time later than receive time, counted as 0 in counts.
+    // only kept for the whole run, per minute histograms leave it 0
+    unsigned long long negative;
+    unsigned long long max;
+};
+
+struct MinuteHistogram {
+    std::string channel;
+    // nanosec at the start of the minute
+    unsigned long long minute;
+    Histogram histogram;
+};
+
+struct ChannelLatency {
+    Histogram whole;
+    unsigned long long minute;
+    Histogram current;
+};
+
+static bool enabled = false;
+static bool persist_minutes = false;
+static bool created = false;
+
+static std::map<std::string, ChannelLatency> channels;
+// minutes over and not written yet
+static std::vector<MinuteHistogram> finished;
+// records of a channel usually come in runs, skip the map lookup for those
+static const char *last_channel_name = NULL;
+static ChannelLatency *last_channel = NULL;
+
+static inline unsigned int bucket_of(unsigned long long value) {
+    if (value < (1ULL << N_LATENCY_SUB_BITS)) {
+        return value;
+    }
+
+    unsigned int exponent = 63 - __builtin_clzll(value);
+    unsigned int shift = exponent - N_LATENCY_SUB_BITS;
+
+    return ((shift + 1) << N_LATENCY_SUB_BITS) + ((value >> shift) & ((1ULL << N_LATENCY_SUB_BITS) - 1));
+}
+
+static unsigned long long bucket_lower(unsigned int bucket) {
+    if (bucket < (1U << N_LATENCY_SUB_BITS)) {
+        return bucket;
+    }
+
+    unsigned int shift = (bucket >> N_LATENCY_SUB_BITS) - 1;
+    unsigned long long sub = bucket & ((1U << N_LATENCY_SUB_BITS) - 1);
+
+    return ((1ULL << N_LATENCY_SUB_BITS) + sub) << shift;
+}
+
+static unsigned long long bucket_upper(unsigned int bucket) {
+    if (bucket == N_LATENCY_BUCKETS - 1) {
+        return ~0ULL;
+    }
+
+    return bucket_lower(bucket + 1) - 1;
+}
+
+static inline void record(Histogram &histogram, unsigned long long value) {
+    histogram.counts[bucket_of(value)]++;
+    histogram.total++;
+
+    if (value > histogram.max) {
+        histogram.max = value;
+    }
+}
+
+// highest value of the bucket the quantile falls into
+static unsigned long long percentile(const Histogram &histogram, double quantile) {
+    unsigned long long rank = (unsigned long long) (quantile * histogram.total);
+    unsigned long long seen = 0;
+
+    for (unsigned int i = 0; i < N_LATENCY_BUCKETS; i++) {
+        seen += histogram.counts[i];
+
+        if (seen > rank) {
+            return bucket_upper(i) < histogram.max ? bucket_upper(i) : histogram.max;
+        }
+    }
+
+    return histogram.max;
+}
+
+void latency_open(bool persist) {
+    enabled = true;
+    persist_minutes = persist;
+}
+
+bool latency_enabled() {
+    return enabled;
+}
+
+void latency_record(const char *channel, unsigned long long receive_timestamp, unsigned long long exchange_timestamp) {
+    if (!enabled) {
+        return;
+    }
+
+    ChannelLatency *latency;
+
+    if (last_channel_name != NULL && strcmp(last_channel_name, channel) == 0) {
+        latency = last_channel;
+    } else {
+        auto found = channels.find(channel);
+
+        if (found == channels.end()) {
+            found = channels.emplace(channel, ChannelLatency()).first;
+            memset(&found->second, 0, sizeof(ChannelLatency));
+            found->second.minute = receive_timestamp / MINUTE * MINUTE;
+        }
+
+        // keys of a std::map do not move
+        last_channel_name = found->first.c_str();
+        last_channel = latency = &found->second;
+    }
+
+    unsigned long long value = 0;
+
+    if (receive_timestamp >= exchange_timestamp) {
+        value = receive_timestamp - exchange_timestamp;
+    } else {
+        latency->whole.negative++;
+    }
+
+    record(latency->whole, value);
+
+    if (!persist_minutes) {
+        return;
+    }
+
+    unsigned long long minute = receive_timestamp / MINUTE * MINUTE;
+
+    if (minute != latency->minute) {
+        if (latency->current.total > 0) {
+            finished.push_back(MinuteHistogram{last_channel_name, latency->minute, latency->current});
+            memset(&latency->current, 0, sizeof(Histogram));
+        }
+        latency->minute = minute;
+    }
+
+    record(latency->current, value);
+}
+
+static void write_minute(sqlite3_stmt *stmt, const char *channel, unsigned long long minute, const Histogram &histogram) {
+    for (unsigned int i = 0; i < N_LATENCY_BUCKETS; i++) {
+        if (histogram.counts[i] == 0) {
+            continue;
+        }
+
+        sqlite3_bind_text(stmt, 1, channel, -1, SQLITE_STATIC);
+        sqlite3_bind_int64(stmt, 2, minute);
+        sqlite3_bind_int64(stmt, 3, bucket_lower(i));
+        sqlite3_bind_int64(stmt, 4, bucket_upper(i));
+        sqlite3_bind_int64(stmt, 5, histogram.counts[i]);
+
+        if (sqlite3_step(stmt) != SQLITE_DONE) {
+            std::cerr << "latency: sqlite error: " << sqlite3_errmsg(sqlite3_db_handle(stmt)) << std::endl;
+            exit(1);
+        }
+
+        sqlite3_reset(stmt);
+    }
+}
+
+void latency_flush(sqlite3 *db, bool all) {
+    if (!persist_minutes) {
+        return;
+    }
+
+    if (all) {
+        for (auto i = channels.begin(); i != channels.end(); i++) {
+            if (i->second.current.total > 0) {
+                finished.push_back(MinuteHistogram{i->first, i->second.minute, i->second.current});
+                memset(&i->second.current, 0, sizeof(Histogram));
+            }
+        }
+    }
+
+    if (finished.empty()) {
+        return;
+    }
+
+    if (!created) {
+        // a bucket holds latencies from lower_ns to upper_ns
+        execute_sql(db,
+            "CREATE TABLE IF NOT EXISTS '_latency' ("
+            "'channel' TEXT NOT NULL,"
+            "'minute' INTEGER NOT NULL,"
+            "'lower_ns' INTEGER NOT NULL,"
+            "'upper_ns' INTEGER NOT NULL,"
+            "'count' INTEGER NOT NULL,"
+            "PRIMARY KEY ('channel', 'minute', 'lower_ns'))");
+        created = true;
+    }
+
+    sqlite3_stmt *stmt;
+
+    // a minute may be split over two flushes or two files
+    int r = sqlite3_prepare_v2(db,
+        "INSERT INTO '_latency' VALUES (?, ?, ?, ?, ?) "
+        "ON CONFLICT (channel, minute, lower_ns) DO UPDATE SET count = count + excluded.count",
+        -1, &stmt, NULL);
+
+    if (r != SQLITE_OK) {
+        std::cerr << "latency: sqlite error: " << sqlite3_errmsg(db) << std::endl;
+        exit(1);
+    }
+
+    for (auto i = finished.begin(); i != finished.end(); i++) {
+        write_minute(stmt, i->channel.c_str(), i->minute, i->histogram);
+    }
+
+    sqlite3_finalize(stmt);
+
+    finished.clear();
+}
+
+void latency_report() {
+    if (!enabled) {
+        return;
+    }
+
+    char line[512];
+
+    std::cerr << "latency in ms, receive - exchange time" << std::endl;
+    snprintf(line, 512, "%-40s %12s %10s %10s %10s %10s %10s",
+        "channel", "count", "negative", "p50", "p99", "p999", "max");
+    std::cerr << line << std::endl;
+
+    for (auto i = channels.begin(); i != channels.end(); i++) {
+        const Histogram &histogram = i->second.whole;
+
+        snprintf(line, 512, "%-40s %12llu %10llu %10.3f %10.3f %10.3f %10.3f",
+            i->first.c_str(),
+            histogram.total,
+            histogram.negative,
+            percentile(histogram, 0.5) / 1e6,
+            percentile(histogram, 0.99) / 1e6,
+            percentile(histogram, 0.999) / 1e6,
+            histogram.max / 1e6);
+        std::cerr << line << std::endl;
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <sqlite3.h>
+
+// receive minus exchange time per channel, recorded into log-bucketed histograms.
+// values below 2^N_LATENCY_SUB_BITS nanosec have a bucket each, above that every power of two
+// is split into 2^N_LATENCY_SUB_BITS buckets, so a bucket is at most 1/16 of its values wide
+#define N_LATENCY_SUB_BITS 4
+#define N_LATENCY_BUCKETS ((64 - N_LATENCY_SUB_BITS + 1) << N_LATENCY_SUB_BITS)
+
+// persist writes a histogram per channel and minute into the _latency table
+void latency_open(bool persist);
+
+bool latency_enabled();
+
+// both in nanosec
+void latency_record(const char *channel, unsigned long long receive_timestamp, unsigned long long exchange_timestamp);
+
+// write histograms of minutes that are over into _latency, or all of them if all is true.
+// call it before a commit
+void latency_flush(sqlite3 *db, bool all);
+
+// print percentiles of every channel to stderr
+void latency_report();
+
+#endif
@@ -0,0 +1,265 @@
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <sqlite3.h>
+
+#include "server.h"
+
+// longest job line accepted
+#define N_JOB 4096
+// seconds a client has to send its job line
+#define N_JOB_TIMEOUT 10
+
+struct Job {
+    // connection the report is sent to
+    int fd;
+    // empty if the server should stop
+    std::string exchange;
+    std::string path;
+};
+
+static std::deque<Job> jobs;
+static std::mutex jobs_mutex;
+static std::condition_variable jobs_cond;
+// set once a shutdown job was received, no more connections are accepted
+static std::atomic<bool> stopping(false);
+// connection of the job being run, -1 if none
+static int running_fd = -1;
+static std::string listen_path;
+
+static void reply(int fd, const char *msg);
+
+static void push_job(const Job &job) {
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+
+        if (!stopping) {
+            jobs.push_back(job);
+            jobs_cond.notify_one();
+            return;
+        }
+    }
+
+    reply(job.fd, "error server is shutting down\n");
+}
+
+// stop taking jobs and answer every one still queued
+static void reject_jobs(const char *msg) {
+    std::deque<Job> rejected;
+
+    {
+        std::lock_guard<std::mutex> lock(jobs_mutex);
+        stopping = true;
+        rejected.swap(jobs);
+    }
+
+    for (auto i = rejected.begin(); i != rejected.end(); i++) {
+        reply(i->fd, msg);
+    }
+}
+
+// a job that fails ends in exit() like any convert, tell its client and everyone queued.
+// staging has its own hook copying what was committed to the destination
+static void server_at_exit() {
+    if (running_fd >= 0) {
+        reply(running_fd, "error job failed, server stopped, see its log\n");
+        running_fd = -1;
+    }
+
+    reject_jobs("error server stopped by a failed job\n");
+
+    if (!listen_path.empty()) {
+        unlink(listen_path.c_str());
+    }
+}
+
+static Job pop_job() {
+    std::unique_lock<std::mutex> lock(jobs_mutex);
+
+    jobs_cond.wait(lock, [] { return !jobs.empty(); });
+
+    Job job = jobs.front();
+    jobs.pop_front();
+
+    return job;
+}
+
+static void reply(int fd, const char *msg) {
+    size_t len = strlen(msg);
+
+    while (len > 0) {
+        // a client that went away must not kill the server with SIGPIPE
+        ssize_t n = send(fd, msg, len, MSG_NOSIGNAL);
+
+        if (n <= 0) {
+            // client went away, nothing to report to
+            break;
+        }
+
+        msg += n;
+        len -= n;
+    }
+
+    close(fd);
+}
+
+// read a line from fd into line, returns false if the client closed before sending one
+static bool read_line(int fd, char *line) {
+    size_t len = 0;
+
+    while (len < N_JOB - 1) {
+        ssize_t n = read(fd, line + len, 1);
+
+        if (n <= 0) {
+            return false;
+        }
+        if (line[len] == '\n') {
+            break;
+        }
+
+        len++;
+    }
+
+    line[len] = '\0';
+
+    return true;
+}
+
+// runs on its own thread per connection, so a client that sends nothing holds up no one else
+static void read_job(int fd) {
+    char line[N_JOB];
+
+    // give up on a client that never finishes its line
+    struct timeval timeout;
+    timeout.tv_sec = N_JOB_TIMEOUT;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(struct timeval));
+
+    if (!read_line(fd, line)) {
+        close(fd);
+        return;
+    }
+
+    if (strcmp(line, "shutdown") == 0) {
+        push_job(Job{fd, "", ""});
+        return;
+    }
+
+    char *space = strchr(line, ' ');
+
+    if (space == NULL) {
+        reply(fd, "error expected \"<exchange> <path>\"\n");
+        return;
+    }
+
+    *space = '\0';
+    push_job(Job{fd, line, space + 1});
+}
+
+static void accept_loop(int listen_fd) {
+    while (true) {
+        int fd = accept(listen_fd, NULL, NULL);
+
+        if (stopping) {
+            if (fd >= 0) {
+                close(fd);
+            }
+            return;
+        }
+
+        if (fd < 0) {
+            std::cerr << "server: accept failed: " << strerror(errno) << std::endl;
+            continue;
+        }
+
+        std::thread(read_job, fd).detach();
+    }
+}
+
+sqlite3 *serve(const char *socket_path, sqlite3 *db, JobRunner run_job) {
+    struct sockaddr_un addr;
+
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        std::cerr << "server: socket path too long" << std::endl;
+        exit(1);
+    }
+
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    // remove a socket left by a previous server
+    unlink(socket_path);
+
+    if (listen_fd < 0 ||
+        bind(listen_fd, (struct sockaddr *) &addr, sizeof(struct sockaddr_un)) != 0 ||
+        listen(listen_fd, SOMAXCONN) != 0) {
+        std::cerr << "server: could not listen on " << socket_path << ": " << strerror(errno) << std::endl;
+        exit(1);
+    }
+
+    std::cerr << "server: listening on " << socket_path << std::endl;
+
+    listen_path = socket_path;
+    atexit(server_at_exit);
+
+    std::thread acceptor(accept_loop, listen_fd);
+
+    char report[N_JOB];
+
+    while (true) {
+        Job job = pop_job();
+
+        if (job.exchange.empty()) {
+            // jobs sent before the shutdown but queued after it are not run
+            reject_jobs("error server is shutting down\n");
+
+            // wake the acceptor up so it sees it has to stop
+            shutdown(listen_fd, SHUT_RDWR);
+
+            reply(job.fd, "ok shutdown\n");
+            break;
+        }
+
+        const char *error = NULL;
+        unsigned long long num_line = 0;
+
+        auto start = std::chrono::steady_clock::now();
+
+        running_fd = job.fd;
+        db = run_job(db, job.exchange.c_str(), job.path.c_str(), &num_line, &error);
+        running_fd = -1;
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (error != NULL) {
+            snprintf(report, N_JOB, "error %s\n", error);
+        } else {
+            snprintf(report, N_JOB, "ok lines=%llu seconds=%.3f lines_per_sec=%.0f\n",
+                num_line, seconds, seconds > 0 ? num_line / seconds : 0);
+        }
+
+        reply(job.fd, report);
+    }
+
+    acceptor.join();
+
+    close(listen_fd);
+    unlink(socket_path);
+    listen_path.clear();
+
+    return db;
+}
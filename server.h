@@ -0,0 +1,18 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <sqlite3.h>
+
+// converts the file at path as exchange, returns the connection writes ended up in.
+// sets error and leaves num_line untouched if the job could not be started
+typedef sqlite3 *(*JobRunner)(sqlite3 *db, const char *exchange, const char *path,
+    unsigned long long *num_line, const char **error);
+
+// listen on a unix domain socket at socket_path and run jobs sent to it one at a time,
+// keeping db and the state of every exchange between jobs.
+// a client sends a line "<exchange> <path>" and gets a line reporting the throughput back,
+// "shutdown" stops the server after queued jobs are done.
+// returns the connection writes ended up in
+sqlite3 *serve(const char *socket_path, sqlite3 *db, JobRunner run_job);
+
+#endif
@@ -0,0 +1,326 @@
+#include <string.h>
+#include <unistd.h>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "staging.h"
+#include "trace.h"
+
+// pages copied by a single sqlite3_backup_step call
+#define N_BACKUP_PAGES 1024
+
+// connection handlers write into
+static sqlite3 *staging_db = NULL;
+// second connection to a staging file used by the flush thread, it reads a wal snapshot
+// so handlers keep committing while it copies. not used for :memory:
+static sqlite3 *reader_db = NULL;
+static sqlite3 *dest_db = NULL;
+static std::string staging_file;
+static bool in_memory = false;
+static unsigned long long staging_budget = 0;
+static time_t last_flush = 0;
+
+static std::thread flusher;
+static std::mutex flush_mutex;
+static std::condition_variable flush_cond;
+static bool flush_requested = false;
+static bool flushing = false;
+static bool flusher_quit = false;
+// copy of an in-memory staging database taken at the checkpoint, owned by the flush thread
+static unsigned char *snapshot = NULL;
+static sqlite3_int64 snapshot_size = 0;
+
+static sqlite3 *open_staging_connection(const char *staging_path) {
+    sqlite3 *db;
+    int r;
+
+    r = sqlite3_open_v2(staging_path, &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+
+    if (r != SQLITE_OK) {
+        std::cerr << "staging: sqlite error: " << sqlite3_errmsg(db) << std::endl;
+        exit(1);
+    }
+
+    // readers of a wal database do not block the writer, this only covers short wal-index locks
+    sqlite3_busy_timeout(db, 10000);
+
+    return db;
+}
+
+static sqlite3_int64 staging_size() {
+    sqlite3_stmt *stmt;
+    sqlite3_int64 size = 0;
+
+    sqlite3_prepare_v2(staging_db,
+        "SELECT page_count * page_size FROM pragma_page_count(), pragma_page_size()", -1, &stmt, NULL);
+
+    if (sqlite3_step(stmt) == SQLITE_ROW) {
+        size = sqlite3_column_int64(stmt, 0);
+    }
+
+    sqlite3_finalize(stmt);
+
+    return size;
+}
+
+// copy the whole database from one connection to another
+static void backup(sqlite3 *from, sqlite3 *to) {
+    int r;
+
+    // hold a read transaction for the whole copy so steps see one snapshot
+    // and the backup is not restarted by commits made in the meantime
+    execute_sql(from, "BEGIN");
+    execute_sql(from, "SELECT count(*) FROM sqlite_master");
+
+    sqlite3_backup *backup = sqlite3_backup_init(to, "main", from, "main");
+
+    if (backup == NULL) {
+        std::cerr << "staging: backup failed: " << sqlite3_errmsg(to) << std::endl;
+        exit(1);
+    }
+
+    do {
+        r = sqlite3_backup_step(backup, N_BACKUP_PAGES);
+
+        if (r == SQLITE_BUSY || r == SQLITE_LOCKED) {
+            sqlite3_sleep(1);
+        }
+    } while (r == SQLITE_OK || r == SQLITE_BUSY || r == SQLITE_LOCKED);
+
+    sqlite3_backup_finish(backup);
+
+    if (r != SQLITE_DONE) {
+        std::cerr << "staging: backup failed: " << sqlite3_errstr(r) << std::endl;
+        exit(1);
+    }
+
+    execute_sql(from, "COMMIT");
+}
+
+// copy a serialized database to the destination through a private in-memory connection
+static void backup_snapshot(unsigned char *data, sqlite3_int64 size) {
+    sqlite3 *db = open_staging_connection(":memory:");
+
+    // the connection frees data when it is closed
+    if (sqlite3_deserialize(db, "main", data, size, size, SQLITE_DESERIALIZE_FREEONCLOSE) != SQLITE_OK) {
+        std::cerr << "staging: deserialize failed: " << sqlite3_errmsg(db) << std::endl;
+        exit(1);
+    }
+
+    backup(db, dest_db);
+
+    sqlite3_close_v2(db);
+}
+
+static void flush_loop() {
+    trace_thread("staging");
+
+    std::unique_lock<std::mutex> lock(flush_mutex);
+
+    while (true) {
+        flush_cond.wait(lock, [] { return flush_requested || flusher_quit; });
+
+        if (flusher_quit) {
+            return;
+        }
+
+        flush_requested = false;
+        flushing = true;
+
+        unsigned char *data = snapshot;
+        sqlite3_int64 size = snapshot_size;
+        snapshot = NULL;
+
+        lock.unlock();
+        {
+            TraceSpan span(TraceBackup);
+
+            if (in_memory) {
+                backup_snapshot(data, size);
+            } else {
+                backup(reader_db, dest_db);
+            }
+        }
+        lock.lock();
+
+        flushing = false;
+    }
+}
+
+// start a background copy, never waits for the flush thread
+static void request_flush() {
+    {
+        std::lock_guard<std::mutex> lock(flush_mutex);
+
+        if (flush_requested || flushing) {
+            // still copying, the next checkpoint takes it again
+            return;
+        }
+    }
+
+    // the flush thread is idle until flush_requested is set, so the snapshot is taken
+    // without holding the lock and an error exit here cannot deadlock staging_at_exit
+    if (in_memory) {
+        // the copy is made by the writer but only costs a memcpy, writing it out
+        // to the destination happens on the flush thread without locking staging
+        snapshot = sqlite3_serialize(staging_db, "main", &snapshot_size, 0);
+
+        if (snapshot == NULL) {
+            std::cerr << "staging: serialize failed: " << sqlite3_errmsg(staging_db) << std::endl;
+            exit(1);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(flush_mutex);
+        flush_requested = true;
+    }
+    last_flush = time(NULL);
+
+    flush_cond.notify_one();
+}
+
+static void stop_flusher() {
+    if (!flusher.joinable()) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(flush_mutex);
+        flusher_quit = true;
+    }
+    flush_cond.notify_one();
+    flusher.join();
+
+    // a snapshot taken but not yet copied
+    sqlite3_free(snapshot);
+    snapshot = NULL;
+}
+
+static void staging_finish() {
+    stop_flusher();
+
+    sqlite3 *db = staging_db;
+
+    // an error exit during the final copy must not come back here from staging_at_exit
+    staging_db = NULL;
+
+    // final copy of everything written so far, nothing is writing anymore
+    {
+        TraceSpan span(TraceBackup);
+        backup(db, dest_db);
+    }
+
+    // a staging file is in wal mode and the backup carries that over, switch the destination back
+    execute_sql(dest_db, "PRAGMA journal_mode=DELETE");
+
+    if (reader_db != NULL) {
+        sqlite3_close_v2(reader_db);
+    }
+    sqlite3_close_v2(db);
+
+    reader_db = NULL;
+
+    if (!in_memory) {
+        // everything is in the destination now
+        unlink(staging_file.c_str());
+        unlink((staging_file + "-wal").c_str());
+        unlink((staging_file + "-shm").c_str());
+    }
+}
+
+// every error in convert ends in exit(), which destroys the flush thread and its condition
+// variable while the thread still waits on them. stop it first, and save what was committed
+// into staging as a convert without staging would have it in the destination
+static void staging_at_exit() {
+    if (staging_db == NULL) {
+        return;
+    }
+
+    if (std::this_thread::get_id() == flusher.get_id()) {
+        // copying to the destination failed, there is nothing left to save
+        _exit(1);
+    }
+
+    stop_flusher();
+
+    if (!sqlite3_get_autocommit(staging_db)) {
+        // the transaction the error interrupted
+        sqlite3_exec(staging_db, "ROLLBACK", NULL, NULL, NULL);
+    }
+
+    staging_finish();
+}
+
+sqlite3 *staging_open(const char *staging_path, sqlite3 *dest, unsigned long long budget) {
+    dest_db = dest;
+    staging_budget = budget;
+    staging_file = staging_path;
+    in_memory = strcmp(staging_path, ":memory:") == 0;
+
+    staging_db = open_staging_connection(staging_path);
+
+    // start from what is already in the destination, converts append to it
+    backup(dest_db, staging_db);
+
+    if (!in_memory) {
+        // lets the flush thread read a snapshot while handlers keep writing
+        execute_sql(staging_db, "PRAGMA journal_mode=WAL");
+        execute_sql(staging_db, "PRAGMA synchronous=OFF");
+
+        reader_db = open_staging_connection(staging_path);
+    }
+
+    last_flush = time(NULL);
+
+    flusher = std::thread(flush_loop);
+
+    atexit(staging_at_exit);
+
+    return staging_db;
+}
+
+sqlite3 *staging_checkpoint(sqlite3 *db) {
+    if (staging_db == NULL || db != staging_db) {
+        // not staging, or already switched to the destination
+        return db;
+    }
+
+    if (staging_budget > 0 && (unsigned long long) staging_size() > staging_budget) {
+        // staging outgrew the memory budget, flush it now and write to the destination directly
+        std::cerr << "staging: budget exceeded, writing to destination from now on" << std::endl;
+        staging_finish();
+
+        return dest_db;
+    }
+
+    if (time(NULL) - last_flush >= N_FLUSH_SECONDS) {
+        request_flush();
+    }
+
+    return db;
+}
+
+sqlite3 *staging_flush(sqlite3 *db) {
+    if (staging_db == NULL || db != staging_db) {
+        return db;
+    }
+
+    request_flush();
+
+    return db;
+}
+
+void staging_close(sqlite3 *db) {
+    if (staging_db == NULL || db != staging_db) {
+        return;
+    }
+
+    staging_finish();
+}
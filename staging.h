@@ -0,0 +1,27 @@
+#ifndef STAGING_H
+#define STAGING_H
+
+#include <sqlite3.h>
+
+// minimum time between two background copies to the destination
+#define N_FLUSH_SECONDS 60
+
+// open a staging database at staging_path (":memory:" or a file on tmpfs) preloaded with
+// the contents of dest, and start a thread copying it back to dest at checkpoints.
+// budget is the maximum size of the staging database in bytes, 0 for unlimited.
+// returns the connection handlers should write into
+sqlite3 *staging_open(const char *staging_path, sqlite3 *dest, unsigned long long budget);
+
+// must be called outside of a transaction, returns the connection to keep writing into.
+// copies to the destination in the background at most every N_FLUSH_SECONDS, since
+// every copy writes the whole staging database out again
+sqlite3 *staging_checkpoint(sqlite3 *db);
+
+// like staging_checkpoint but starts a copy regardless of the time since the last one,
+// unless one is still running
+sqlite3 *staging_flush(sqlite3 *db);
+
+// copy everything to the destination, close the staging database and delete a staging file
+void staging_close(sqlite3 *db);
+
+#endif
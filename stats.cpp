@@ -0,0 +1,151 @@
+#include <string.h>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "stats.h"
+
+struct BlockStats {
+    sqlite3_int64 block;
+    unsigned long long row_count;
+    unsigned long long min_timestamp;
+    unsigned long long max_timestamp;
+    double min_price;
+    double max_price;
+};
+
+struct TableStats {
+    // block rows are currently written into
+    BlockStats current;
+    // blocks filled since the last flush
+    std::vector<BlockStats> done;
+};
+
+static std::map<std::string, TableStats> tables;
+// rows of a table usually come in runs, skip the map lookup for those
+static const char *last_table_name = NULL;
+static TableStats *last_table = NULL;
+
+static bool created = false;
+
+static void start_block(BlockStats &stats, sqlite3_int64 block) {
+    stats.block = block;
+    stats.row_count = 0;
+}
+
+void stats_row(const char *table_name, sqlite3_int64 rowid, unsigned long long timestamp, double price) {
+    TableStats *table;
+
+    if (last_table_name != NULL && strcmp(last_table_name, table_name) == 0) {
+        table = last_table;
+    } else {
+        auto found = tables.find(table_name);
+
+        if (found == tables.end()) {
+            found = tables.emplace(table_name, TableStats()).first;
+            start_block(found->second.current, rowid / N_STATS_BLOCK);
+        }
+
+        table = &found->second;
+        // keys of a std::map do not move
+        last_table_name = found->first.c_str();
+        last_table = table;
+    }
+
+    BlockStats &current = table->current;
+    sqlite3_int64 block = rowid / N_STATS_BLOCK;
+
+    if (block != current.block) {
+        if (current.row_count > 0) {
+            table->done.push_back(current);
+        }
+        start_block(current, block);
+    }
+
+    if (current.row_count == 0) {
+        current.min_timestamp = current.max_timestamp = timestamp;
+        current.min_price = current.max_price = price;
+    } else {
+        if (timestamp < current.min_timestamp) current.min_timestamp = timestamp;
+        if (timestamp > current.max_timestamp) current.max_timestamp = timestamp;
+        if (price < current.min_price) current.min_price = price;
+        if (price > current.max_price) current.max_price = price;
+    }
+
+    current.row_count++;
+}
+
+static void write_block(sqlite3_stmt *stmt, const char *table_name, const BlockStats &stats) {
+    sqlite3_bind_text(stmt, 1, table_name, -1, SQLITE_STATIC);
+    sqlite3_bind_int64(stmt, 2, stats.block);
+    sqlite3_bind_int64(stmt, 3, stats.row_count);
+    sqlite3_bind_int64(stmt, 4, stats.min_timestamp);
+    sqlite3_bind_int64(stmt, 5, stats.max_timestamp);
+    sqlite3_bind_double(stmt, 6, stats.min_price);
+    sqlite3_bind_double(stmt, 7, stats.max_price);
+
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        std::cerr << "stats: sqlite error: " << sqlite3_errmsg(sqlite3_db_handle(stmt)) << std::endl;
+        exit(1);
+    }
+
+    sqlite3_reset(stmt);
+}
+
+void stats_flush(sqlite3 *db) {
+    if (tables.empty()) {
+        return;
+    }
+
+    if (!created) {
+        execute_sql(db,
+            "CREATE TABLE IF NOT EXISTS '_stats' ("
+            "'table_name' TEXT NOT NULL,"
+            "'block' INTEGER NOT NULL,"
+            "'row_count' INTEGER NOT NULL,"
+            "'min_timestamp' INTEGER NOT NULL,"
+            "'max_timestamp' INTEGER NOT NULL,"
+            "'min_price' REAL NOT NULL,"
+            "'max_price' REAL NOT NULL,"
+            "PRIMARY KEY ('table_name', 'block'))");
+        created = true;
+    }
+
+    sqlite3_stmt *stmt;
+
+    // a block may already have rows from an earlier commit or an earlier convert
+    int r = sqlite3_prepare_v2(db,
+        "INSERT INTO '_stats' VALUES (?, ?, ?, ?, ?, ?, ?) "
+        "ON CONFLICT (table_name, block) DO UPDATE SET "
+        "row_count = row_count + excluded.row_count,"
+        "min_timestamp = min(min_timestamp, excluded.min_timestamp),"
+        "max_timestamp = max(max_timestamp, excluded.max_timestamp),"
+        "min_price = min(min_price, excluded.min_price),"
+        "max_price = max(max_price, excluded.max_price)",
+        -1, &stmt, NULL);
+
+    if (r != SQLITE_OK) {
+        std::cerr << "stats: sqlite error: " << sqlite3_errmsg(db) << std::endl;
+        exit(1);
+    }
+
+    for (auto i = tables.begin(); i != tables.end(); i++) {
+        TableStats &table = i->second;
+
+        for (auto block = table.done.begin(); block != table.done.end(); block++) {
+            write_block(stmt, i->first.c_str(), *block);
+        }
+        table.done.clear();
+
+        if (table.current.row_count > 0) {
+            write_block(stmt, i->first.c_str(), table.current);
+            // keep counting the same block, only rows from now on
+            table.current.row_count = 0;
+        }
+    }
+
+    sqlite3_finalize(stmt);
+}
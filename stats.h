@@ -0,0 +1,17 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <sqlite3.h>
+
+// keeps a _stats table with the row count, timestamp range and price range of every
+// table per block of N_STATS_BLOCK rowids, so queries can find rowid ranges without scanning.
+// block b of a table holds rowids from b * N_STATS_BLOCK to (b + 1) * N_STATS_BLOCK - 1
+#define N_STATS_BLOCK 65536
+
+// count a row just written into table_name
+void stats_row(const char *table_name, sqlite3_int64 rowid, unsigned long long timestamp, double price);
+
+// write rows counted since the last call into _stats, call it before every commit
+void stats_flush(sqlite3 *db);
+
+#endif
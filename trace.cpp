@@ -0,0 +1,253 @@
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+#include "trace.h"
+
+#define N_TRACE_ARG 48
+
+bool trace_enabled = false;
+
+static const char *phase_names[N_TRACE_PHASE] = {
+    "read",
+    "parse",
+    "handler",
+    "insert",
+    "commit",
+    "backup",
+};
+
+// spans of these phases are always kept, they are rare and what stalls look like
+static const bool phase_always[N_TRACE_PHASE] = {
+    false,
+    false,
+    false,
+    false,
+    true,
+    true,
+};
+
+struct TraceEvent {
+    const char *name;
+    // 'X' span, 'i' instant or 'C' counter
+    char type;
+    char arg[N_TRACE_ARG];
+    unsigned long long timestamp;
+    // duration of a span, value of a counter
+    unsigned long long value;
+};
+
+struct TraceBuffer {
+    int tid;
+    const char *name;
+    // only the owning thread writes, trace_close reads after it stopped
+    std::atomic<unsigned long long> head;
+    // events before this one are in the file already
+    unsigned long long flushed;
+    TraceEvent events[N_TRACE_EVENTS];
+    // time spent in each phase since the last batch
+    unsigned long long totals[N_TRACE_PHASE];
+    unsigned long long batch_start;
+};
+
+static const char *filename = NULL;
+static FILE *out = NULL;
+// threads write full buffers into out themselves
+static std::mutex out_mutex;
+static unsigned long long trace_start;
+static std::mutex buffers_mutex;
+static std::vector<TraceBuffer *> buffers;
+static thread_local TraceBuffer *local = NULL;
+
+static TraceBuffer *local_buffer() {
+    if (local == NULL) {
+        local = new TraceBuffer();
+        local->name = "thread";
+        local->head.store(0);
+        local->flushed = 0;
+        memset(local->totals, 0, sizeof(local->totals));
+        local->batch_start = trace_now();
+
+        std::lock_guard<std::mutex> lock(buffers_mutex);
+        local->tid = buffers.size() + 1;
+        buffers.push_back(local);
+    }
+
+    return local;
+}
+
+static TraceEvent &next_event(TraceBuffer *buffer) {
+    unsigned long long head = buffer->head.load(std::memory_order_relaxed);
+
+    return buffer->events[head % N_TRACE_EVENTS];
+}
+
+static void write_string(FILE *out, const char *str) {
+    fputc('"', out);
+
+    for (; *str != '\0'; str++) {
+        if (*str == '"' || *str == '\\') {
+            fputc('\\', out);
+        }
+        if ((unsigned char) *str >= 0x20) {
+            fputc(*str, out);
+        }
+    }
+
+    fputc('"', out);
+}
+
+static void write_event(const TraceBuffer *buffer, const TraceEvent &event) {
+    // trace-event timestamps are microsec
+    double timestamp = (event.timestamp - trace_start) / 1000.0;
+
+    fprintf(out, ",\n{\"ph\":\"%c\",\"name\":", event.type);
+    write_string(out, event.name);
+    fprintf(out, ",\"pid\":1,\"tid\":%d,\"ts\":%.3f", buffer->tid, timestamp);
+
+    if (event.type == 'X') {
+        fprintf(out, ",\"dur\":%.3f", event.value / 1000.0);
+    } else if (event.type == 'i') {
+        fprintf(out, ",\"s\":\"t\"");
+    }
+
+    if (event.type == 'C') {
+        fprintf(out, ",\"args\":{\"us\":%.3f}", event.value / 1000.0);
+    } else if (event.arg[0] != '\0') {
+        fprintf(out, ",\"args\":{\"name\":");
+        write_string(out, event.arg);
+        fprintf(out, "}");
+    }
+
+    fprintf(out, "}");
+}
+
+// write events recorded since the last flush, called by the owning thread or after it stopped
+static void flush_buffer(TraceBuffer *buffer) {
+    std::lock_guard<std::mutex> lock(out_mutex);
+
+    unsigned long long head = buffer->head.load(std::memory_order_acquire);
+
+    for (unsigned long long j = buffer->flushed; j < head; j++) {
+        write_event(buffer, buffer->events[j % N_TRACE_EVENTS]);
+    }
+
+    buffer->flushed = head;
+}
+
+static void publish(TraceBuffer *buffer) {
+    unsigned long long head = buffer->head.load(std::memory_order_relaxed) + 1;
+
+    buffer->head.store(head, std::memory_order_release);
+
+    if (head - buffer->flushed == N_TRACE_EVENTS) {
+        // full, write it out before anything is overwritten so long runs keep their start
+        flush_buffer(buffer);
+    }
+}
+
+static void add_event(TraceBuffer *buffer, char type, const char *name, const char *arg,
+    unsigned long long timestamp, unsigned long long value) {
+
+    TraceEvent &event = next_event(buffer);
+
+    event.name = name;
+    event.type = type;
+    event.timestamp = timestamp;
+    event.value = value;
+
+    if (arg != NULL) {
+        strncpy(event.arg, arg, N_TRACE_ARG - 1);
+        event.arg[N_TRACE_ARG - 1] = '\0';
+    } else {
+        event.arg[0] = '\0';
+    }
+
+    publish(buffer);
+}
+
+void trace_span(TracePhase phase, unsigned long long start) {
+    TraceBuffer *buffer = local_buffer();
+    unsigned long long duration = trace_now() - start;
+
+    buffer->totals[phase] += duration;
+
+    if (phase_always[phase] || duration >= TRACE_MIN_SPAN) {
+        add_event(buffer, 'X', phase_names[phase], NULL, start, duration);
+    }
+}
+
+void trace_instant_event(const char *name, const char *arg) {
+    add_event(local_buffer(), 'i', name, arg, trace_now(), 0);
+}
+
+void trace_batch_event() {
+    TraceBuffer *buffer = local_buffer();
+    unsigned long long now = trace_now();
+
+    add_event(buffer, 'X', "batch", NULL, buffer->batch_start, now - buffer->batch_start);
+
+    for (int i = 0; i < N_TRACE_PHASE; i++) {
+        add_event(buffer, 'C', phase_names[i], NULL, buffer->batch_start, buffer->totals[i]);
+        buffer->totals[i] = 0;
+    }
+
+    buffer->batch_start = now;
+}
+
+void trace_thread(const char *name) {
+    if (trace_enabled) {
+        local_buffer()->name = name;
+    }
+}
+
+void trace_open(const char *trace_filename) {
+    filename = trace_filename;
+    out = fopen(filename, "w");
+
+    if (out == NULL) {
+        std::cerr << "trace: could not open " << filename << std::endl;
+        exit(1);
+    }
+
+    // every event written after this starts with a comma
+    fprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(out, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":1,\"args\":{\"name\":\"convert\"}}");
+
+    trace_start = trace_now();
+    trace_enabled = true;
+}
+
+void trace_close() {
+    if (!trace_enabled) {
+        return;
+    }
+
+    trace_enabled = false;
+
+    std::lock_guard<std::mutex> lock(buffers_mutex);
+
+    for (auto i = buffers.begin(); i != buffers.end(); i++) {
+        TraceBuffer *buffer = *i;
+
+        // every thread has stopped, write what is left in its buffer
+        flush_buffer(buffer);
+
+        fprintf(out, ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":",
+            buffer->tid);
+        write_string(out, buffer->name);
+        fprintf(out, "}}");
+    }
+
+    fprintf(out, "\n]}\n");
+
+    if (fclose(out) != 0) {
+        std::cerr << "trace: write failed" << std::endl;
+        exit(1);
+    }
+
+    out = NULL;
+}
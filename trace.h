@@ -0,0 +1,84 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <time.h>
+
+// records spans of pipeline phases into a buffer per thread and writes them as chrome
+// trace-event json whenever a buffer fills, to be opened in perfetto or chrome://tracing.
+// spans shorter than TRACE_MIN_SPAN are only added to per batch totals, shown as counters
+
+// nanosec
+#define TRACE_MIN_SPAN 1000000
+// events buffered per thread, a full buffer is written to the file by its thread
+#define N_TRACE_EVENTS (1 << 17)
+
+enum TracePhase {
+    TraceRead,
+    TraceParse,
+    TraceHandler,
+    TraceInsert,
+    TraceCommit,
+    TraceBackup,
+    N_TRACE_PHASE,
+};
+
+// checked before anything else is done, so tracing costs a branch when it is off
+extern bool trace_enabled;
+
+inline unsigned long long trace_now() {
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (unsigned long long) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+void trace_span(TracePhase phase, unsigned long long start);
+
+// lasts until the end of the scope
+class TraceSpan {
+public:
+    TraceSpan(TracePhase phase) : phase(phase), start(0) {
+        if (trace_enabled) {
+            start = trace_now();
+        }
+    }
+
+    ~TraceSpan() {
+        if (trace_enabled) {
+            trace_span(phase, start);
+        }
+    }
+
+private:
+    TracePhase phase;
+    unsigned long long start;
+};
+
+inline void trace_instant(const char *name, const char *arg) {
+    void trace_instant_event(const char *name, const char *arg);
+
+    if (trace_enabled) {
+        trace_instant_event(name, arg);
+    }
+}
+
+// end a batch of lines, emitting a span for it and the time spent in each phase
+inline void trace_batch() {
+    void trace_batch_event();
+
+    if (trace_enabled) {
+        trace_batch_event();
+    }
+}
+
+// name the calling thread in the trace
+void trace_thread(const char *name);
+
+// start tracing, the trace is written into filename by trace_close
+void trace_open(const char *filename);
+
+// must be called when no other thread is tracing anymore
+void trace_close();
+
+#endif
@@ -0,0 +1,258 @@
+#include <string.h>
+#include <iostream>
+#include <map>
+#include <string>
+#include <sqlite3.h>
+
+#include "common.h"
+#include "stats.h"
+#include "unified.h"
+
+struct ChannelIds {
+    sqlite3_int64 exchange_id;
+    sqlite3_int64 symbol_id;
+};
+
+// table name prefixes of every exchange, the rest of a table name is the symbol
+static const char *prefixes[][2] = {
+    { "trade_", "bitmex" },
+    { "orderBookL2_", "bitmex" },
+    { "trades_", "bitfinex" },
+    { "book_", "bitfinex" },
+    { "lightning_executions_", "bitflyer" },
+    { "lightning_board_", "bitflyer" },
+    { "lightning_ticker_", "bitflyer" },
+};
+
+static bool enabled = false;
+static bool created = false;
+static std::map<std::string, ChannelIds> channels;
+// rows of a channel usually come in runs, skip the map lookup for those
+static const char *last_table_name = NULL;
+static ChannelIds *last_channel = NULL;
+
+// statements are prepared for this connection, staging may switch to another one
+static sqlite3 *stmt_db = NULL;
+static sqlite3_stmt *trade_stmt = NULL;
+static sqlite3_stmt *book_stmt = NULL;
+static sqlite3_stmt *ticker_stmt = NULL;
+
+static sqlite3_stmt *prepare_or_die(sqlite3 *db, const char *sql) {
+    sqlite3_stmt *stmt;
+
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        std::cerr << "unified: sqlite error: " << sqlite3_errmsg(db) << std::endl;
+        exit(1);
+    }
+
+    return stmt;
+}
+
+static void step_or_die(sqlite3_stmt *stmt) {
+    if (sqlite3_step(stmt) != SQLITE_DONE) {
+        std::cerr << "unified: sqlite error: " << sqlite3_errmsg(sqlite3_db_handle(stmt)) << std::endl;
+        exit(1);
+    }
+
+    sqlite3_reset(stmt);
+}
+
+static void create_tables(sqlite3 *db) {
+    execute_sql(db,
+        "CREATE TABLE IF NOT EXISTS 'exchanges' ("
+        "'id' INTEGER PRIMARY KEY,"
+        "'name' TEXT NOT NULL UNIQUE)");
+
+    execute_sql(db,
+        "CREATE TABLE IF NOT EXISTS 'symbols' ("
+        "'id' INTEGER PRIMARY KEY,"
+        "'exchange_id' INTEGER NOT NULL REFERENCES 'exchanges',"
+        "'name' TEXT NOT NULL,"
+        "UNIQUE ('exchange_id', 'name'))");
+
+    execute_sql(db,
+        "CREATE TABLE IF NOT EXISTS 'trades' ("
+        "'exchange_id' INTEGER NOT NULL,"
+        "'symbol_id' INTEGER NOT NULL,"
+        "'timestamp' INTEGER NOT NULL,"
+        "'price' REAL NOT NULL,"
+        "'size' REAL NOT NULL)");
+
+    execute_sql(db,
+        "CREATE TABLE IF NOT EXISTS 'book' ("
+        "'exchange_id' INTEGER NOT NULL,"
+        "'symbol_id' INTEGER NOT NULL,"
+        "'timestamp' INTEGER NOT NULL,"
+        "'price' REAL NOT NULL,"
+        "'size' REAL NOT NULL)");
+
+    execute_sql(db,
+        "CREATE TABLE IF NOT EXISTS 'ticker' ("
+        "'exchange_id' INTEGER NOT NULL,"
+        "'symbol_id' INTEGER NOT NULL,"
+        "'timestamp' INTEGER NOT NULL,"
+        "'best_bid' REAL NOT NULL,"
+        "'best_bid_size' REAL NOT NULL,"
+        "'total_bid_depth' REAL NOT NULL,"
+        "'best_ask' REAL NOT NULL,"
+        "'best_ask_size' REAL NOT NULL,"
+        "'total_ask_depth' REAL NOT NULL,"
+        "'last_traded_price' REAL NOT NULL,"
+        "'volume' REAL NOT NULL,"
+        "'volume_by_product' REAL NOT NULL)");
+}
+
+// insert a row into exchanges or symbols unless it exists, and return its id
+static sqlite3_int64 dimension_id(sqlite3 *db, const char *insert_sql, const char *select_sql,
+    sqlite3_int64 exchange_id, const char *name) {
+
+    sqlite3_stmt *stmt;
+    sqlite3_int64 id;
+
+    stmt = prepare_or_die(db, insert_sql);
+    if (exchange_id >= 0) {
+        sqlite3_bind_int64(stmt, 1, exchange_id);
+        sqlite3_bind_text(stmt, 2, name, -1, SQLITE_STATIC);
+    } else {
+        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+    }
+    step_or_die(stmt);
+    sqlite3_finalize(stmt);
+
+    stmt = prepare_or_die(db, select_sql);
+    if (exchange_id >= 0) {
+        sqlite3_bind_int64(stmt, 1, exchange_id);
+        sqlite3_bind_text(stmt, 2, name, -1, SQLITE_STATIC);
+    } else {
+        sqlite3_bind_text(stmt, 1, name, -1, SQLITE_STATIC);
+    }
+    if (sqlite3_step(stmt) != SQLITE_ROW) {
+        std::cerr << "unified: could not find id of " << name << std::endl;
+        exit(1);
+    }
+    id = sqlite3_column_int64(stmt, 0);
+    sqlite3_finalize(stmt);
+
+    return id;
+}
+
+static ChannelIds *channel_ids(sqlite3 *db, const char *table_name) {
+    if (last_table_name != NULL && strcmp(last_table_name, table_name) == 0) {
+        return last_channel;
+    }
+
+    auto found = channels.find(table_name);
+
+    if (found == channels.end()) {
+        if (!created) {
+            create_tables(db);
+            created = true;
+        }
+
+        const char *exchange = "unknown";
+        const char *symbol = table_name;
+
+        for (size_t i = 0; i < sizeof(prefixes) / sizeof(prefixes[0]); i++) {
+            if (strncmp(table_name, prefixes[i][0], strlen(prefixes[i][0])) == 0) {
+                exchange = prefixes[i][1];
+                symbol = table_name + strlen(prefixes[i][0]);
+                break;
+            }
+        }
+
+        ChannelIds ids;
+        ids.exchange_id = dimension_id(db,
+            "INSERT OR IGNORE INTO 'exchanges' ('name') VALUES (?)",
+            "SELECT id FROM 'exchanges' WHERE name = ?",
+            -1, exchange);
+        ids.symbol_id = dimension_id(db,
+            "INSERT OR IGNORE INTO 'symbols' ('exchange_id', 'name') VALUES (?, ?)",
+            "SELECT id FROM 'symbols' WHERE exchange_id = ? AND name = ?",
+            ids.exchange_id, symbol);
+
+        found = channels.emplace(table_name, ids).first;
+    }
+
+    // keys of a std::map do not move
+    last_table_name = found->first.c_str();
+    last_channel = &found->second;
+
+    return last_channel;
+}
+
+static void prepare_statements(sqlite3 *db) {
+    if (db == stmt_db) {
+        return;
+    }
+
+    sqlite3_finalize(trade_stmt);
+    sqlite3_finalize(book_stmt);
+    sqlite3_finalize(ticker_stmt);
+
+    trade_stmt = prepare_or_die(db, "INSERT INTO 'trades' VALUES (?, ?, ?, ?, ?)");
+    book_stmt = prepare_or_die(db, "INSERT INTO 'book' VALUES (?, ?, ?, ?, ?)");
+    ticker_stmt = prepare_or_die(db, "INSERT INTO 'ticker' VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+
+    stmt_db = db;
+}
+
+void unified_open() {
+    enabled = true;
+}
+
+bool unified_enabled() {
+    return enabled;
+}
+
+void unified_channel(sqlite3 *db, const char *table_name) {
+    channel_ids(db, table_name);
+}
+
+static void write_level(sqlite3 *db, sqlite3_stmt *stmt, const char *unified_table, const char *table_name,
+    unsigned long long timestamp, double price, double size) {
+
+    ChannelIds *ids = channel_ids(db, table_name);
+
+    sqlite3_bind_int64(stmt, 1, ids->exchange_id);
+    sqlite3_bind_int64(stmt, 2, ids->symbol_id);
+    sqlite3_bind_int64(stmt, 3, timestamp);
+    sqlite3_bind_double(stmt, 4, price);
+    sqlite3_bind_double(stmt, 5, size);
+
+    step_or_die(stmt);
+
+    stats_row(unified_table, sqlite3_last_insert_rowid(db), timestamp, price);
+}
+
+void unified_trade(sqlite3 *db, const char *table_name, unsigned long long timestamp, double price, double size) {
+    prepare_statements(db);
+    write_level(db, trade_stmt, "trades", table_name, timestamp, price, size);
+}
+
+void unified_book(sqlite3 *db, const char *table_name, unsigned long long timestamp, double price, double size) {
+    prepare_statements(db);
+    write_level(db, book_stmt, "book", table_name, timestamp, price, size);
+}
+
+void unified_ticker(sqlite3 *db, const char *table_name, unsigned long long timestamp, const TickerData &ticker) {
+    prepare_statements(db);
+
+    ChannelIds *ids = channel_ids(db, table_name);
+
+    sqlite3_bind_int64(ticker_stmt, 1, ids->exchange_id);
+    sqlite3_bind_int64(ticker_stmt, 2, ids->symbol_id);
+    sqlite3_bind_int64(ticker_stmt, 3, timestamp);
+    sqlite3_bind_double(ticker_stmt, 4, ticker.best_bid);
+    sqlite3_bind_double(ticker_stmt, 5, ticker.best_bid_size);
+    sqlite3_bind_double(ticker_stmt, 6, ticker.total_bid_depth);
+    sqlite3_bind_double(ticker_stmt, 7, ticker.best_ask);
+    sqlite3_bind_double(ticker_stmt, 8, ticker.best_ask_size);
+    sqlite3_bind_double(ticker_stmt, 9, ticker.total_ask_depth);
+    sqlite3_bind_double(ticker_stmt, 10, ticker.last_traded_price);
+    sqlite3_bind_double(ticker_stmt, 11, ticker.volume);
+    sqlite3_bind_double(ticker_stmt, 12, ticker.volume_by_product);
+
+    step_or_die(ticker_stmt);
+
+    stats_row("ticker", sqlite3_last_insert_rowid(db), timestamp, ticker.last_traded_price);
+}
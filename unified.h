@@ -0,0 +1,25 @@
+#ifndef UNIFIED_H
+#define UNIFIED_H
+
+#include <sqlite3.h>
+
+#include "common.h"
+
+// alternative schema with a single trades, book and ticker table for every exchange and symbol.
+// rows carry exchange_id and symbol_id referring to the exchanges and symbols tables,
+// which are derived from the table name create_new_table would have used
+
+void unified_open();
+
+bool unified_enabled();
+
+// register the exchange and symbol of a channel
+void unified_channel(sqlite3 *db, const char *table_name);
+
+void unified_trade(sqlite3 *db, const char *table_name, unsigned long long timestamp, double price, double size);
+
+void unified_book(sqlite3 *db, const char *table_name, unsigned long long timestamp, double price, double size);
+
+void unified_ticker(sqlite3 *db, const char *table_name, unsigned long long timestamp, const TickerData &ticker);
+
+#endif